@@ -0,0 +1,345 @@
+#include "jpeg_encoder.hpp"
+#include "lib.hpp"
+#include "payload_pool.hpp"
+#include "pixel_format.hpp"
+#include "simulated.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iterator>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <server_ws.hpp>
+
+// Times every per-frame stage between the camera buffer and the bytes a
+// client receives, on synthetic frames, and prints latency percentiles and
+// throughput per stage as CSV or JSON.
+
+using namespace std::chrono;
+
+using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
+
+struct Stage
+{
+    std::string name;
+    // bytes of input per call, for the throughput in MB/s
+    size_t inputBytes;
+    std::function<void()> run;
+};
+
+struct Result
+{
+    std::string resolution, stage;
+    size_t iterations;
+    double p50, p90, p99, max, mean;
+    size_t inputBytes;
+};
+
+static double
+percentile(const std::vector<double>& sorted, double p)
+{
+    const auto index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static Result
+measure(const Stage& stage, size_t warmup, size_t iterations)
+{
+    for (size_t i = 0; i < warmup; i++)
+        stage.run();
+
+    std::vector<double> us(iterations);
+    for (auto& sample : us) {
+        const auto start = steady_clock::now();
+        stage.run();
+        sample = duration<double, std::micro>(steady_clock::now() - start)
+                   .count();
+    }
+
+    std::sort(us.begin(), us.end());
+
+    Result result;
+    result.stage = stage.name;
+    result.iterations = iterations;
+    result.p50 = percentile(us, 0.50);
+    result.p90 = percentile(us, 0.90);
+    result.p99 = percentile(us, 0.99);
+    result.max = us.back();
+    result.mean = 0.0;
+    for (double sample : us)
+        result.mean += sample / static_cast<double>(iterations);
+    result.inputBytes = stage.inputBytes;
+
+    return result;
+}
+
+/**
+ *  One synthetic frame of the given source, as raw camera data.
+ */
+static std::vector<uint8_t>
+syntheticFrame(const std::string& format, int width, int height)
+{
+    cv::SimulatedVideoCapture capture(
+      fmt::format("synthetic:{}:{}x{}@0", format, width, height));
+    capture.setExceptionMode(true);
+    capture.open();
+    capture.grab();
+
+    cv::RawFrame raw;
+    capture.rawFrame(raw);
+
+    const auto* data = static_cast<const uint8_t*>(raw.data);
+    return std::vector<uint8_t>(data, data + raw.size);
+}
+
+static std::vector<Result>
+benchResolution(int width, int height, size_t warmup, size_t iterations)
+{
+    auto mono = syntheticFrame("Mono8", width, height);
+    auto bayer = syntheticFrame("BayerRG8", width, height);
+    const size_t pixels = static_cast<size_t>(width) * height;
+
+    const auto& monoFormat =
+      *cv::describePixelFormat(cv::PEAK_PIXEL_FORMAT_MONO8);
+    const auto& bayerFormat =
+      *cv::describePixelFormat(cv::PEAK_PIXEL_FORMAT_BAYERRG8);
+
+    cv::Mat image, scratch, bgr, gray;
+    cv::convertRawFrame(bayer.data(),
+                        height,
+                        width,
+                        bayerFormat,
+                        cv::PEAK_DEBAYER_FULL,
+                        false,
+                        scratch,
+                        bgr);
+    cv::convertRawFrame(mono.data(),
+                        height,
+                        width,
+                        monoFormat,
+                        cv::PEAK_DEBAYER_NONE,
+                        false,
+                        scratch,
+                        gray);
+
+    std::vector<uchar> jpg;
+    cv::imencode(".jpg", bgr, jpg);
+
+    std::vector<Stage> stages = {
+        { "retrieve_copy",
+          pixels,
+          [&]() {
+              cv::convertRawFrame(mono.data(),
+                                  height,
+                                  width,
+                                  monoFormat,
+                                  cv::PEAK_DEBAYER_NONE,
+                                  false,
+                                  scratch,
+                                  image);
+          } },
+        { "debayer_full",
+          pixels,
+          [&]() {
+              cv::convertRawFrame(bayer.data(),
+                                  height,
+                                  width,
+                                  bayerFormat,
+                                  cv::PEAK_DEBAYER_FULL,
+                                  false,
+                                  scratch,
+                                  image);
+          } },
+        { "debayer_half",
+          pixels,
+          [&]() {
+              cv::convertRawFrame(bayer.data(),
+                                  height,
+                                  width,
+                                  bayerFormat,
+                                  cv::PEAK_DEBAYER_HALF,
+                                  false,
+                                  scratch,
+                                  image);
+          } },
+    };
+
+    for (const char* ext : { ".jpg", ".png", ".webp" })
+        stages.push_back({ fmt::format("imencode{}", ext),
+                           bgr.total() * bgr.elemSize(),
+                           [&bgr, ext]() {
+                               std::vector<uchar> buffer;
+                               cv::imencode(ext, bgr, buffer);
+                           } });
+
+    // the streamer's JPEG path, libjpeg-turbo if built with it
+    auto jpegEncoder = std::make_shared<XVII::JpegEncoder>();
+    for (const auto* input : { &gray, &bgr })
+        stages.push_back({ input == &gray ? "jpeg_encoder_gray"
+                                          : "jpeg_encoder_bgr",
+                           input->total() * input->elemSize(),
+                           [input, jpegEncoder]() {
+                               const uchar* data;
+                               size_t size;
+                               jpegEncoder->encode(*input, {}, data, size);
+                           } });
+
+    // before pooled payloads
+    stages.push_back({ "ws_payload", jpg.size(), [&jpg]() {
+                          auto buffer = jpg;
+                          auto payload =
+                            std::make_shared<WsServer::OutMessage>(
+                              buffer.size());
+                          std::move(buffer.begin(),
+                                    buffer.end(),
+                                    std::ostream_iterator<uchar>(*payload));
+                      } });
+
+    // as in StreamServer::capture_thread
+    auto pool = std::make_shared<XVII::PayloadPool>(1);
+    stages.push_back({ "ws_payload_pooled", jpg.size(), [&jpg, pool]() {
+                          pool->acquire(jpg.data(), jpg.size());
+                      } });
+
+    // as in to_v4l of peakcvbridge-capture
+    stages.push_back({ "to_v4l_yuyv", pixels, [&gray]() {
+                          cv::Mat color, yuyv;
+                          cv::cvtColor(gray, color, cv::COLOR_GRAY2BGR);
+                          cv::cvtColor(color, yuyv, cv::COLOR_BGR2YUV_YUYV);
+                      } });
+
+    std::vector<Result> results;
+    for (const auto& stage : stages) {
+        results.push_back(measure(stage, warmup, iterations));
+        results.back().resolution = fmt::format("{}x{}", width, height);
+    }
+
+    return results;
+}
+
+static void
+printCsv(FILE* out, const std::vector<Result>& results)
+{
+    fmt::println(out,
+                 "resolution,stage,iterations,p50_us,p90_us,p99_us,max_us,"
+                 "mean_us,fps,mb_per_s");
+
+    for (const auto& r : results)
+        fmt::println(out,
+                     "{},{},{},{:.1f},{:.1f},{:.1f},{:.1f},"
+                     "{:.1f},{:.1f},{:.1f}",
+                     r.resolution,
+                     r.stage,
+                     r.iterations,
+                     r.p50,
+                     r.p90,
+                     r.p99,
+                     r.max,
+                     r.mean,
+                     1e6 / r.mean,
+                     static_cast<double>(r.inputBytes) / r.mean);
+}
+
+static void
+printJson(FILE* out, const std::vector<Result>& results)
+{
+    fmt::println(out, "[");
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        fmt::println(out,
+                     "  {{\"resolution\": \"{}\", \"stage\": \"{}\", "
+                     "\"iterations\": {}, \"p50_us\": {:.1f}, "
+                     "\"p90_us\": {:.1f}, \"p99_us\": {:.1f}, "
+                     "\"max_us\": {:.1f}, \"mean_us\": {:.1f}, "
+                     "\"fps\": {:.1f}, \"mb_per_s\": {:.1f}}}{}",
+                     r.resolution,
+                     r.stage,
+                     r.iterations,
+                     r.p50,
+                     r.p90,
+                     r.p99,
+                     r.max,
+                     r.mean,
+                     1e6 / r.mean,
+                     static_cast<double>(r.inputBytes) / r.mean,
+                     i + 1 < results.size() ? "," : "");
+    }
+
+    fmt::println(out, "]");
+}
+
+int
+main(int argc, char** argv)
+{
+    cxxopts::Options desc(argv[0], "per-frame hot path benchmark");
+
+    // clang-format off
+
+    desc.add_options()
+        ("h,help", "produce this message")
+        ("r,resolutions", "comma separated <width>x<height> list", cxxopts::value<std::vector<std::string>>()->default_value("1936x1216,2448x2048,4024x3036"))
+        ("n,iterations", "measured calls per stage", cxxopts::value<size_t>()->default_value("100"))
+        ("w,warmup", "unmeasured calls per stage", cxxopts::value<size_t>()->default_value("5"))
+        ("f,format", "output format: csv or json", cxxopts::value<std::string>()->default_value("csv"))
+        ("o,output", "output file instead of stdout", cxxopts::value<std::string>());
+
+    // clang-format on
+
+    auto args = desc.parse(argc, argv);
+
+    if (args.count("help")) {
+        fmt::println("{}", desc.help());
+        return EXIT_SUCCESS;
+    }
+
+    const auto iterations =
+      std::max<size_t>(1, args["iterations"].as<size_t>());
+    const auto warmup = args["warmup"].as<size_t>();
+    const auto format = args["format"].as<std::string>();
+
+    if (format != "csv" && format != "json") {
+        fmt::println(stderr, "Unknown output format: {}", format);
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (const auto& resolution :
+         args["resolutions"].as<std::vector<std::string>>()) {
+        int width, height;
+        if (std::sscanf(resolution.c_str(), "%dx%d", &width, &height) != 2 ||
+            width < 2 || height < 2) {
+            fmt::println(stderr, "Invalid resolution: {}", resolution);
+            return 1;
+        }
+
+        fmt::println(stderr, "{}...", resolution);
+        auto r = benchResolution(width, height, warmup, iterations);
+        results.insert(results.end(), r.begin(), r.end());
+    }
+
+    FILE* out = stdout;
+    if (args.count("output")) {
+        const auto path = args["output"].as<std::string>();
+        out = std::fopen(path.c_str(), "w");
+        if (nullptr == out) {
+            fmt::println(stderr, "Cannot open {}", path);
+            return 1;
+        }
+    }
+
+    if (format == "csv")
+        printCsv(out, results);
+    else
+        printJson(out, results);
+
+    if (out != stdout)
+        std::fclose(out);
+
+    return 0;
+}
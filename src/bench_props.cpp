@@ -0,0 +1,187 @@
+#include "lib.hpp"
+
+#include <chrono>
+#include <cmath>
+
+#include <cxxopts.hpp>
+#include <fmt/core.h>
+
+// Measures the per-call cost of the property reads peakcvbridge-capture does
+// once per frame, resolving nodes by name on every call (as get() used to)
+// versus the node handles PeakVideoCapture caches in open(). Then measures how
+// many frames a set() on a streaming capture costs, for a property written
+// live and for one that has to cycle acquisition.
+
+using namespace std::chrono;
+
+template<typename F>
+static double
+nsPerCall(size_t iterations, F&& f)
+{
+    volatile double sink = 0.0;
+
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < iterations; i++)
+        sink = sink + f();
+    auto stop = steady_clock::now();
+
+    return duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+template<typename TNode>
+static bool
+isReadable(const std::shared_ptr<TNode>& node)
+{
+    using peak::core::nodes::NodeAccessStatus;
+    auto status = node->AccessStatus();
+    return status == NodeAccessStatus::ReadOnly ||
+           status == NodeAccessStatus::ReadWrite;
+}
+
+static double
+uncachedGet(const std::shared_ptr<peak::core::NodeMap>& nodeMap, int propId)
+{
+    switch (propId) {
+        case cv::CAP_PROP_EXPOSURE: {
+            auto node =
+              nodeMap->FindNode<peak::core::nodes::FloatNode>("ExposureTime");
+            return isReadable(node) ? node->Value() : 0;
+        }
+        case cv::CAP_PROP_FPS: {
+            auto node = nodeMap->FindNode<peak::core::nodes::FloatNode>(
+              "AcquisitionFrameRate");
+            return isReadable(node) ? node->Value() : 0;
+        }
+        case cv::CAP_PROP_TRIGGER: {
+            auto node = nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
+              "TriggerMode");
+            return isReadable(node) &&
+                   node->CurrentEntry()->StringValue() == "On";
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  Frames lost by writing the current value of propId while streaming,
+ *  estimated from the time between the last frame before the write and the
+ *  first frame after it, in frame periods.
+ */
+static double
+framesLostPerChange(cv::PeakVideoCapture& cap, int propId, size_t changes)
+{
+    cv::Mat image;
+    double lost = 0.0;
+
+    for (size_t i = 0; i < changes; i++) {
+        // the first read may return a frame that was already waiting
+        cap.read(image);
+        cap.read(image);
+
+        const double period = 1.0 / cap.get(cv::CAP_PROP_FPS);
+        const auto before = steady_clock::now();
+
+        cap.set(propId, cap.get(propId));
+        cap.read(image);
+
+        const double gap =
+          duration<double>(steady_clock::now() - before).count();
+        lost += std::max(0.0, std::round(gap / period) - 1.0);
+    }
+
+    return lost / static_cast<double>(changes);
+}
+
+int
+main(int argc, char** argv)
+{
+    cxxopts::Options desc(argv[0], "node lookup microbenchmark");
+
+    // clang-format off
+
+    desc.add_options()
+        ("h,help", "produce this message")
+        ("c,camera", "camera index", cxxopts::value<int>()->default_value("0"))
+        ("n,iterations", "calls per property", cxxopts::value<size_t>()->default_value("10000"))
+        ("m,changes", "set() calls per property while streaming", cxxopts::value<size_t>()->default_value("20"));
+
+    // clang-format on
+
+    auto args = desc.parse(argc, argv);
+
+    if (args.count("help")) {
+        fmt::println("{}", desc.help());
+        return EXIT_SUCCESS;
+    }
+
+    const auto cameraIndex = args["camera"].as<int>();
+    const auto iterations = args["iterations"].as<size_t>();
+    const auto changes = args["changes"].as<size_t>();
+
+    const std::pair<int, const char*> props[] = {
+        { cv::CAP_PROP_TRIGGER, "CAP_PROP_TRIGGER" },
+        { cv::CAP_PROP_FPS, "CAP_PROP_FPS" },
+        { cv::CAP_PROP_EXPOSURE, "CAP_PROP_EXPOSURE" },
+    };
+    double uncached[std::size(props)], cached[std::size(props)];
+
+    // initializes the peak library
+    auto idsCap = std::make_unique<cv::PeakVideoCapture>();
+
+    {
+        auto& deviceManager = peak::DeviceManager::Instance();
+        deviceManager.Update();
+
+        auto device = deviceManager.Devices()
+                        .at(static_cast<size_t>(cameraIndex))
+                        ->OpenDevice(peak::core::DeviceAccessType::Control);
+        auto nodeMap = device->RemoteDevice()->NodeMaps().at(0);
+
+        for (size_t i = 0; i < std::size(props); i++)
+            uncached[i] = nsPerCall(iterations, [&]() {
+                return uncachedGet(nodeMap, props[i].first);
+            });
+    }
+
+    idsCap->setExceptionMode(true);
+    idsCap->open(cameraIndex);
+
+    for (size_t i = 0; i < std::size(props); i++)
+        cached[i] = nsPerCall(
+          iterations, [&]() { return idsCap->get(props[i].first); });
+
+    // ExposureTime is only writeable with autoexposure off
+    idsCap->set(cv::CAP_PROP_AUTO_EXPOSURE, false);
+    idsCap->set(cv::CAP_PROP_PEAK_ACQUISITION_MODE,
+                cv::PEAK_ACQUISITION_LATEST);
+
+    const std::pair<int, const char*> changed[] = {
+        { cv::CAP_PROP_EXPOSURE, "CAP_PROP_EXPOSURE" },
+        { cv::CAP_PROP_TRIGGER, "CAP_PROP_TRIGGER" },
+    };
+    double lost[std::size(changed)];
+
+    for (size_t i = 0; i < std::size(changed); i++)
+        lost[i] = framesLostPerChange(*idsCap, changed[i].first, changes);
+
+    idsCap->release();
+
+    fmt::println("{:<20}{:>16}{:>16}{:>10}",
+                 "property",
+                 "FindNode [ns]",
+                 "cached [ns]",
+                 "speedup");
+    for (size_t i = 0; i < std::size(props); i++)
+        fmt::println("{:<20}{:>16.1f}{:>16.1f}{:>9.1f}x",
+                     props[i].second,
+                     uncached[i],
+                     cached[i],
+                     uncached[i] / cached[i]);
+
+    fmt::println("\n{:<20}{:>16}", "property", "frames lost/set");
+    for (size_t i = 0; i < std::size(changed); i++)
+        fmt::println("{:<20}{:>16.2f}", changed[i].second, lost[i]);
+
+    return 0;
+}
@@ -1,4 +1,9 @@
 #include "lib.hpp"
+#include "pixel_format.hpp"
+#include "recording.hpp"
+#include "shared_frames.hpp"
+#include "simulated.hpp"
+#include "trace.hpp"
 
 #include <bits/chrono.h>
 #include <fcntl.h>
@@ -47,6 +52,8 @@ operator>>(std::istream& is, std::optional<T>& opt)
 void
 to_v4l(const cv::Mat& _img, int fd)
 {
+    PEAKCVBRIDGE_SPAN("to_v4l");
+
     static bool had_ioctl = false;
     static size_t size_image;
 
@@ -89,15 +96,69 @@ to_v4l(const cv::Mat& _img, int fd)
         fmt::println(stderr, "write failed: {}", strerror(errno));
 }
 
+static bool
+record(const cv::RawFrameSource& source, cv::RecordingWriter& writer)
+{
+    cv::RawFrame frame;
+    if (!source.rawFrame(frame))
+        return false;
+
+    const auto& metadata = source.frameMetadata();
+
+    cv::RecordingIndexEntry entry = {};
+    entry.size = frame.size;
+    entry.timestampNs = metadata.timestampNs;
+    entry.frameId = metadata.frameId;
+    entry.width = static_cast<uint32_t>(frame.width);
+    entry.height = static_cast<uint32_t>(frame.height);
+    entry.pixelFormat = frame.pixelFormat;
+    entry.flags = metadata.incomplete ? cv::RECORDING_FRAME_INCOMPLETE : 0;
+
+    return writer.append(frame.data, entry);
+}
+
+static bool
+share(const cv::RawFrameSource& source, cv::SharedFramePublisher& publisher)
+{
+    cv::RawFrame frame;
+    if (!source.rawFrame(frame))
+        return false;
+
+    const auto& metadata = source.frameMetadata();
+
+    cv::SharedFrame shared;
+    shared.data = frame.data;
+    shared.size = frame.size;
+    shared.width = static_cast<uint32_t>(frame.width);
+    shared.height = static_cast<uint32_t>(frame.height);
+    shared.pixelFormat = frame.pixelFormat;
+    shared.frameId = metadata.frameId;
+    shared.timestampNs = metadata.timestampNs;
+    shared.incomplete = metadata.incomplete;
+
+    return publisher.publish(shared);
+}
+
 static bool ctrlc = false;
+static bool dump_trace = false;
+
+static void
+write_trace(const std::string& path)
+{
+    if (cv::dumpTrace(path))
+        fmt::println(stderr, "\nTrace written to {}", path);
+    else
+        fmt::println(stderr, "\nWriting the trace to {} failed", path);
+}
 
 int
 main(int argc, char** argv)
 {
-    bool trigger, auto_exposure, is_v4l;
+    bool trigger, auto_exposure, is_v4l, latest, chunks;
     double target_fps;
     std::optional<double> exposure_ms;
     int camera_index, v4l_fd = -1;
+    size_t num_buffers, record_buffers, shm_slots;
 
     cxxopts::Options desc(argv[0], "capture client for peakcvbridge");
 
@@ -106,11 +167,22 @@ main(int argc, char** argv)
     desc.add_options()
         ("h,help", "produce this message")
         ("c,camera", "camera index", cxxopts::value<int>()->default_value("0"))
+        ("s,source", "capture from synthetic[:<format>[:<width>x<height>]] (rate set by -f) or replay:<path>[:fast][:loop] instead of a camera", cxxopts::value<std::string>()->default_value(""))
         ("t,trigger", "enable trigger on Line0")
         ("f,framerate", "target fps", cxxopts::value<double>()->default_value("30.0"))
         ("a,auto-exposure", "enable auto exposure")
+        ("l,latest", "acquire on a background thread and always show the newest frame")
+        ("chunks", "receive exposure time and gain with every frame as chunk data")
+        ("d,debayer", "debayer mode for color cameras: full, half or none", cxxopts::value<std::string>()->default_value("full"))
         ("v,v4l2loopback", "write to v4ltoloopback device", cxxopts::value<std::string>()->implicit_value("/dev/video0"))
-        ("e,exposure", "set exposure time in milliseconds. enabling auto-exposure will cause this to be ignored", cxxopts::value<double>());
+        ("e,exposure", "set exposure time in milliseconds. enabling auto-exposure will cause this to be ignored", cxxopts::value<double>())
+        ("b,buffers", "number of buffers to announce, 0 for the minimum required", cxxopts::value<size_t>()->default_value("0"))
+        ("buffer-alloc", "buffer allocation: sdk, aligned, hugepages or locked", cxxopts::value<std::string>()->default_value("sdk"))
+        ("r,record", "write raw frames to a recording at this path instead of showing them", cxxopts::value<std::string>())
+        ("record-buffers", "frames staged in memory while the disk is busy", cxxopts::value<size_t>()->default_value("64"))
+        ("shm", "also publish raw frames to local processes as this shared memory object, see shared_frames.hpp", cxxopts::value<std::string>())
+        ("shm-slots", "frames kept in the shared memory ring", cxxopts::value<size_t>()->default_value("4"))
+        ("trace", "write trace spans to this path on SIGUSR1 and at exit, when built with PEAKCVBRIDGE_TRACE", cxxopts::value<std::string>());
 
     // clang-format on
 
@@ -125,6 +197,8 @@ main(int argc, char** argv)
     trigger = args.count("trigger");
     target_fps = args["framerate"].as<double>();
     auto_exposure = args.count("auto-exposure");
+    latest = args.count("latest");
+    chunks = args.count("chunks");
     if ((is_v4l = args.count("v4l2loopback"))) {
         auto devpath = args["v4l2loopback"].as<std::string>();
         v4l_fd = open(devpath.c_str(), O_WRONLY, 0);
@@ -134,11 +208,47 @@ main(int argc, char** argv)
     }
     if (args.count("exposure"))
         exposure_ms = args["exposure"].as<double>();
+    num_buffers = args["buffers"].as<size_t>();
+    record_buffers = args["record-buffers"].as<size_t>();
+    shm_slots = args["shm-slots"].as<size_t>();
+
+    cv::PeakDebayerMode debayer_mode;
+    if (const auto mode = args["debayer"].as<std::string>(); mode == "full")
+        debayer_mode = cv::PEAK_DEBAYER_FULL;
+    else if (mode == "half")
+        debayer_mode = cv::PEAK_DEBAYER_HALF;
+    else if (mode == "none")
+        debayer_mode = cv::PEAK_DEBAYER_NONE;
+    else {
+        fmt::println(stderr, "Unknown debayer mode: {}", mode);
+        return 1;
+    }
+
+    cv::PeakBufferAllocation buffer_alloc;
+    if (const auto alloc = args["buffer-alloc"].as<std::string>();
+        alloc == "sdk")
+        buffer_alloc = cv::PEAK_BUFFER_ALLOC_SDK;
+    else if (alloc == "aligned")
+        buffer_alloc = cv::PEAK_BUFFER_ALLOC_PAGE_ALIGNED;
+    else if (alloc == "hugepages")
+        buffer_alloc = cv::PEAK_BUFFER_ALLOC_HUGEPAGES;
+    else if (alloc == "locked")
+        buffer_alloc = cv::PEAK_BUFFER_ALLOC_LOCKED;
+    else {
+        fmt::println(stderr, "Unknown buffer allocation: {}", alloc);
+        return 1;
+    }
 
     // without unique_ptr, PeakVideoCapture gets "sliced" into VideoCapture,
     // thus calling the wrong functions
     // https://stackoverflow.com/questions/1444025/c-overridden-method-not-getting-called
-    auto idsCap = std::make_unique<cv::PeakVideoCapture>(true);
+    auto idsCap =
+      cv::createVideoCapture(args["source"].as<std::string>(), true);
+
+    idsCap->set(cv::CAP_PROP_PEAK_DEBAYER_MODE, debayer_mode);
+    idsCap->set(cv::CAP_PROP_BUFFERSIZE, static_cast<double>(num_buffers));
+    idsCap->set(cv::CAP_PROP_PEAK_BUFFER_ALLOCATION, buffer_alloc);
+    idsCap->set(cv::CAP_PROP_PEAK_CHUNKS, chunks);
 
     idsCap->setExceptionMode(true);
 
@@ -166,18 +276,63 @@ main(int argc, char** argv)
     if (idsCap->set(cv::CAP_PROP_TRIGGER, trigger))
         fmt::println("{} trigger on Line0", trigger ? "Enabled" : "Disabled");
 
+    if (latest && idsCap->set(cv::CAP_PROP_PEAK_ACQUISITION_MODE,
+                              cv::PEAK_ACQUISITION_LATEST))
+        fmt::println("Dropping stale frames");
+
+    std::unique_ptr<cv::RecordingWriter> recorder;
+    const auto* raw_source = dynamic_cast<cv::RawFrameSource*>(idsCap.get());
+
+    // as packed by the camera, unlisted formats take a whole buffer
+    const auto pixel_format = static_cast<cv::PeakPixelFormat>(
+      idsCap->get(cv::CAP_PROP_PEAK_PIXEL_FORMAT));
+    const auto* format = cv::describePixelFormat(pixel_format);
+    const auto max_frame_size =
+      nullptr != format
+        ? cv::packedSize(
+            format->packing,
+            static_cast<size_t>(idsCap->get(cv::CAP_PROP_FRAME_WIDTH)) *
+              static_cast<size_t>(idsCap->get(cv::CAP_PROP_FRAME_HEIGHT)))
+        : static_cast<size_t>(idsCap->get(cv::CAP_PROP_PEAK_PAYLOAD_SIZE));
+
+    if (args.count("record") && nullptr != raw_source) {
+        const auto path = args["record"].as<std::string>();
+
+        recorder = std::make_unique<cv::RecordingWriter>();
+        if (!recorder->open(path, max_frame_size, record_buffers)) {
+            fmt::println(stderr, "Cannot record to {}", path);
+            return 1;
+        }
+
+        fmt::println("Recording to {}", path);
+    }
+
+    cv::SharedFramePublisher publisher;
+    if (args.count("shm") && nullptr != raw_source) {
+        const auto name = args["shm"].as<std::string>();
+
+        if (!publisher.open(name, max_frame_size, shm_slots)) {
+            fmt::println(stderr, "Cannot publish frames as {}", name);
+            return 1;
+        }
+
+        fmt::println("Publishing frames as {}", name);
+    }
+
     idsCap->setExceptionMode(true);
 
-    if (!args.count("v4l2loopback"))
+    if (!is_v4l && !recorder)
         cv::namedWindow("Stream", cv::WINDOW_KEEPRATIO);
 
+    const auto record_start = steady_clock::now();
+
     {
         size_t framecount_total = 0, framecount_interval = 0;
-        auto tick = system_clock::now();
+        std::optional<uint64_t> interval_start_ns;
         double fps = 0.0;
 
         std::function<bool(void)> poll;
-        if (is_v4l)
+        if (is_v4l || recorder)
             poll = []() { return true; };
         else
             poll = []() { return cv::pollKey() != 'q'; };
@@ -188,44 +343,113 @@ main(int argc, char** argv)
             ctrlc = true;
         });
 
+        std::string trace_path;
+        if (args.count("trace")) {
+            trace_path = args["trace"].as<std::string>();
+            signal(SIGUSR1, [](int) { dump_trace = true; });
+        }
+
         while (poll() && !ctrlc) {
 
-            cv::Mat image;
+            if (dump_trace) {
+                dump_trace = false;
+                write_trace(trace_path);
+            }
 
-            if (!idsCap->read(image))
+            if (!idsCap->grab())
                 continue;
 
-            auto tock = system_clock::now();
+            // before decoding, local consumers get the frame first
+            if (publisher.isOpened() && 0 != publisher.readers())
+                share(*raw_source, publisher);
+
+            if (recorder) {
+                // dropped frames are counted by the recorder
+                record(*raw_source, *recorder);
+            } else {
+                cv::Mat image;
 
-            if (!is_v4l)
-                cv::imshow("Stream", image);
-            else
-                to_v4l(image, v4l_fd);
+                if (!idsCap->retrieve(image))
+                    continue;
 
-            if (isatty(STDOUT_FILENO) && !ctrlc) {
+                if (!is_v4l)
+                    cv::imshow("Stream", image);
+                else
+                    to_v4l(image, v4l_fd);
+            }
 
-                ++framecount_interval;
+            if (isatty(STDOUT_FILENO) && !ctrlc && nullptr != raw_source) {
+                const auto& metadata = raw_source->frameMetadata();
 
-                if (!idsCap->get(cv::CAP_PROP_TRIGGER)) {
-                    fps = idsCap->get(cv::CAP_PROP_FPS);
-                } else if (1e6 <=
-                           duration_cast<microseconds>(tock - tick).count()) {
-                    tick = tock;
-                    fps = framecount_interval;
+                // measured on device timestamps, triggered or not. They
+                // restart e.g. with a device reset, and so does the interval
+                if (!interval_start_ns ||
+                    metadata.timestampNs < *interval_start_ns) {
+                    interval_start_ns = metadata.timestampNs;
                     framecount_interval = 0;
+                } else {
+                    ++framecount_interval;
+
+                    const auto elapsed_ns =
+                      metadata.timestampNs - *interval_start_ns;
+                    if (1'000'000'000 <= elapsed_ns) {
+                        fps = 1e9 * framecount_interval / elapsed_ns;
+                        interval_start_ns = metadata.timestampNs;
+                        framecount_interval = 0;
+                    }
                 }
 
-                fmt::print("\r[{}]\t{:.3f} ms\t{:.3f} FPS\t\t",
+                const auto exposure_us =
+                  metadata.exposureTime.has_value()
+                    ? *metadata.exposureTime
+                    : idsCap->get(cv::CAP_PROP_EXPOSURE);
+                const auto counters = raw_source->frameCounters();
+
+                fmt::print("\r[{}]\t{:.3f} ms\t{:.3f} FPS\t"
+                           "{} lost\t{} incomplete\t{} underruns\t\t",
                            ++framecount_total,
-                           idsCap->get(cv::CAP_PROP_EXPOSURE) / 1000.,
-                           fps);
+                           exposure_us / 1000.,
+                           fps,
+                           counters.lost,
+                           counters.incomplete,
+                           counters.underruns);
+
+                if (recorder) {
+                    const auto stats = recorder->statistics();
+                    const double elapsed_s =
+                      duration<double>(steady_clock::now() - record_start)
+                        .count();
+
+                    fmt::print("{:.1f} MB/s\t{} dropped (I/O)\t\t",
+                               stats.bytesWritten / 1e6 / elapsed_s,
+                               stats.framesDropped);
+                }
+
                 fflush(stdout);
             }
         }
+
+        if (!trace_path.empty())
+            write_trace(trace_path);
     }
 
+    publisher.close();
     idsCap->release();
     close(v4l_fd);
 
+    if (recorder) {
+        recorder->close();
+
+        const auto stats = recorder->statistics();
+        const double elapsed_s =
+          duration<double>(steady_clock::now() - record_start).count();
+        fmt::println("\nRecorded {} frames ({:.1f} MB, {:.1f} MB/s), {} "
+                     "dropped due to I/O backpressure",
+                     stats.framesWritten,
+                     stats.bytesWritten / 1e6,
+                     stats.bytesWritten / 1e6 / elapsed_s,
+                     stats.framesDropped);
+    }
+
     return 0;
 }
\ No newline at end of file
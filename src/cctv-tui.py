@@ -1,3 +1,5 @@
+from __future__ import annotations
+
 from textual import on
 from textual.app import App, ComposeResult, Binding
 from textual.containers import ScrollableContainer, Container
@@ -7,15 +9,21 @@ from textual.reactive import reactive
 
 from websockets.client import connect
 from os.path import splitext, basename, join, dirname, exists
-from typing import Optional
+from typing import Optional, Tuple
 
 import os
 import re
+import time
+import struct
 import asyncio
 import cv2 as cv
 import numpy as np
 
 HOSTNAME_REGEX = re.compile("^(([a-zA-Z0-9]|[a-zA-Z0-9][a-zA-Z0-9\-]*[a-zA-Z0-9])\.)*([A-Za-z0-9]|[A-Za-z0-9][A-Za-z0-9\-]*[A-Za-z0-9])$")
+# FrameHeader in src/stream_protocol.hpp
+FRAME_HEADER = struct.Struct("<4sHHQQQIIIBBBB")
+FRAME_CODEC_RAW = 0
+
 IP_REGEX = re.compile("^(([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])\.){3}([0-9]|[1-9][0-9]|1[0-9]{2}|2[0-4][0-9]|25[0-5])$")
 
 def is_valid_host(input: str) -> bool:
@@ -26,6 +34,23 @@ def is_valid_host(input: str) -> bool:
     except:
         return False
 
+def decode_frame(message: bytes) -> Tuple[np.ndarray, float]:
+    (magic, _, header_size, frame_id, _, send_ns, width, height, _, codec,
+     _, channels, bytes_per_sample) = FRAME_HEADER.unpack_from(message)
+    if magic != b"PCVF":
+        raise ValueError("not a framed message")
+
+    payload = np.frombuffer(message, dtype=np.uint8, offset=header_size)
+    if codec == FRAME_CODEC_RAW:
+        dtype = np.uint8 if bytes_per_sample == 1 else np.uint16
+        image = payload.view(dtype).reshape(height, width, channels)
+    else:
+        image = cv.imdecode(payload, 0)
+
+    # only meaningful with synchronized clocks
+    latency_ms = (time.time_ns() - send_ns) / 1e6
+    return image, latency_ms
+
 class CameraEntry(Static):
     client_task: asyncio.Task[None] = None
     flip: Optional[int] = None
@@ -82,21 +107,33 @@ class CameraEntry(Static):
 
                 # TODO already handle camera_status "error" here
 
-                await endpoint.send("start")
+                # servers without the frame header ignore this start
+                await endpoint.send("start header=1")
+                framed, received = True, False
                 while not self.task_should_stop:
                     try:
                         image_data = await asyncio.wait_for(endpoint.recv(), timeout=5)
-                    except TimeoutError:
-                        endpoint.send("status")
+                    except asyncio.TimeoutError:
+                        if framed and not received:
+                            framed = False
+                            await endpoint.send("start")
+                            continue
+                        await endpoint.send("status")
                         self.update_camera_status(await endpoint.recv())
                         continue
-                    
-                    self.update_camera_status("streaming")
-                    
-                    image = cv.imdecode(
-                        np.frombuffer(image_data, dtype=np.uint8),
-                        0
-                    )
+
+                    if isinstance(image_data, str):
+                        self.update_camera_status(image_data)
+                        continue
+
+                    received = True
+                    if framed:
+                        image, latency_ms = decode_frame(image_data)
+                        self.update_camera_status(f"streaming ({latency_ms:.0f} ms)")
+                    else:
+                        image = cv.imdecode(np.frombuffer(image_data, dtype=np.uint8), 0)
+                        self.update_camera_status("streaming")
+
                     if self.flip is not None:
                         image = cv.flip(image, self.flip)
                     cv.imshow(self.remote_host, image)
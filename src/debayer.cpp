@@ -0,0 +1,147 @@
+#include "debayer.hpp"
+
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace cv {
+
+namespace {
+
+/**
+ *  Sample positions in a 2x2 quad. OpenCV names Bayer patterns after the
+ *  second and third pixel of the second row, so e.g. COLOR_BayerBG2BGR has
+ *  blue at the bottom right of each quad.
+ */
+struct QuadLayout
+{
+    // greens on the anti-diagonal (RG, BG) or on the diagonal (GR, GB)
+    bool greenDiagonal;
+    // red sits on the top row of the quad
+    bool redTop;
+};
+
+QuadLayout
+quadLayout(int code)
+{
+    switch (code) {
+        case COLOR_BayerBG2BGR:
+            return { false, true };
+        case COLOR_BayerRG2BGR:
+            return { false, false };
+        case COLOR_BayerGB2BGR:
+            return { true, true };
+        case COLOR_BayerGR2BGR:
+            return { true, false };
+        default:
+            CV_Error(Error::StsBadFlag, "Unsupported Bayer conversion code");
+    }
+}
+
+template<typename T>
+struct SimdReg;
+
+#if CV_SIMD
+template<>
+struct SimdReg<uchar>
+{
+    using type = v_uint8;
+};
+
+template<>
+struct SimdReg<ushort>
+{
+    using type = v_uint16;
+};
+#endif
+
+template<typename T>
+void
+superpixelRows(const Mat& src, Mat& dst, QuadLayout layout, const Range& rows)
+{
+    const int width = dst.cols;
+
+    for (int y = rows.start; y < rows.end; y++) {
+        const T* top = src.ptr<T>(2 * y);
+        const T* bottom = src.ptr<T>(2 * y + 1);
+        T* out = dst.ptr<T>(y);
+
+        int x = 0;
+
+#if CV_SIMD
+        using V = typename SimdReg<T>::type;
+        constexpr int lanes = static_cast<int>(sizeof(V) / sizeof(T));
+
+        for (; x <= width - lanes; x += lanes) {
+            V topEven, topOdd, bottomEven, bottomOdd;
+            v_load_deinterleave(top + 2 * x, topEven, topOdd);
+            v_load_deinterleave(bottom + 2 * x, bottomEven, bottomOdd);
+
+            V green, topColor, bottomColor;
+            if (layout.greenDiagonal) {
+                green = v_avg(topEven, bottomOdd);
+                topColor = topOdd;
+                bottomColor = bottomEven;
+            } else {
+                green = v_avg(topOdd, bottomEven);
+                topColor = topEven;
+                bottomColor = bottomOdd;
+            }
+
+            if (layout.redTop)
+                v_store_interleave(out + 3 * x, bottomColor, green, topColor);
+            else
+                v_store_interleave(out + 3 * x, topColor, green, bottomColor);
+        }
+#endif
+
+        for (; x < width; x++) {
+            const T* t = top + 2 * x;
+            const T* b = bottom + 2 * x;
+
+            T green, topColor, bottomColor;
+            if (layout.greenDiagonal) {
+                green = static_cast<T>((t[0] + b[1] + 1) >> 1);
+                topColor = t[1];
+                bottomColor = b[0];
+            } else {
+                green = static_cast<T>((t[1] + b[0] + 1) >> 1);
+                topColor = t[0];
+                bottomColor = b[1];
+            }
+
+            out[3 * x + 0] = layout.redTop ? bottomColor : topColor;
+            out[3 * x + 1] = green;
+            out[3 * x + 2] = layout.redTop ? topColor : bottomColor;
+        }
+    }
+
+#if CV_SIMD
+    vx_cleanup();
+#endif
+}
+
+}
+
+void
+debayerSuperpixel(const Mat& src, Mat& dst, int code)
+{
+    CV_Assert(src.type() == CV_8UC1 || src.type() == CV_16UC1);
+
+    const auto layout = quadLayout(code);
+    const bool wide = src.depth() == CV_16U;
+
+    dst.create(src.rows / 2, src.cols / 2, wide ? CV_16UC3 : CV_8UC3);
+
+    // stripes of a few rows keep the per-task overhead negligible
+    parallel_for_(
+      Range(0, dst.rows),
+      [&](const Range& rows) {
+          if (wide)
+              superpixelRows<ushort>(src, dst, layout, rows);
+          else
+              superpixelRows<uchar>(src, dst, layout, rows);
+      },
+      dst.rows / 16.0);
+}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+namespace cv {
+
+/**
+ *  Converts an 8 or 16-bit Bayer mosaic to a half-width, half-height BGR image
+ *  of the same depth, turning every 2x2 quad into one pixel and averaging its
+ *  two green samples.
+ *
+ *  code is one of the cv::COLOR_Bayer**2BGR codes, the pattern is interpreted
+ *  exactly like cv::cvtColor does for the same code.
+ */
+void
+debayerSuperpixel(const Mat& src, Mat& dst, int code);
+
+}
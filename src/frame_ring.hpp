@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace cv {
+
+/**
+ *  Bounded lock-free single-producer single-consumer ring.
+ *  The capacity is rounded up to a power of two.
+ */
+template<typename T>
+class SpscRing
+{
+  private:
+    std::vector<T> _slots;
+    size_t _mask;
+
+    // written by the producer only
+    alignas(64) std::atomic_size_t _head = 0;
+    // written by the consumer only
+    alignas(64) std::atomic_size_t _tail = 0;
+
+  public:
+    explicit SpscRing(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+
+        _slots.resize(size);
+        _mask = size - 1;
+    }
+
+    size_t capacity() const { return _slots.size(); }
+
+    size_t size() const
+    {
+        return _head.load(std::memory_order_acquire) -
+               _tail.load(std::memory_order_acquire);
+    }
+
+    bool push(const T& value)
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == _slots.size())
+            return false;
+
+        _slots[head & _mask] = value;
+        _head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail == _head.load(std::memory_order_acquire))
+            return false;
+
+        value = _slots[tail & _mask];
+        _tail.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+};
+
+/**
+ *  Single-slot mailbox where every publish replaces the previous value.
+ *  The replaced value is handed back to the producer so it can be recycled.
+ */
+class LatestSlot
+{
+  public:
+    static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+  private:
+    std::atomic_uint32_t _value = EMPTY;
+
+  public:
+    // returns the value that was not consumed in time, or EMPTY
+    uint32_t publish(uint32_t value)
+    {
+        return _value.exchange(value, std::memory_order_acq_rel);
+    }
+
+    // returns the most recent value, or EMPTY
+    uint32_t take()
+    {
+        return _value.exchange(EMPTY, std::memory_order_acq_rel);
+    }
+};
+
+}
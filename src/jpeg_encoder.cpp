@@ -0,0 +1,117 @@
+#include "jpeg_encoder.hpp"
+
+#include <fmt/core.h>
+#include <opencv2/imgcodecs.hpp>
+
+#ifdef PEAKCVBRIDGE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+using namespace XVII;
+
+#ifdef PEAKCVBRIDGE_TURBOJPEG
+static int
+turbo_subsampling(int subsampling)
+{
+    switch (subsampling) {
+        case 444:
+            return TJSAMP_444;
+        case 422:
+            return TJSAMP_422;
+        case 440:
+            return TJSAMP_440;
+        case 411:
+            return TJSAMP_411;
+        default:
+            return TJSAMP_420;
+    }
+}
+#endif
+
+JpegEncoder::JpegEncoder()
+{
+#ifdef PEAKCVBRIDGE_TURBOJPEG
+    _handle = tjInitCompress();
+    if (nullptr == _handle)
+        fmt::println(stderr,
+                     "[jpeg] tjInitCompress failed, using cv::imencode: {}",
+                     tjGetErrorStr2(nullptr));
+#endif
+}
+
+JpegEncoder::~JpegEncoder()
+{
+#ifdef PEAKCVBRIDGE_TURBOJPEG
+    tjFree(_buffer);
+    if (nullptr != _handle)
+        tjDestroy(_handle);
+#endif
+}
+
+bool
+JpegEncoder::encode(const cv::Mat& image,
+                    const JpegSettings& settings,
+                    const uchar*& data,
+                    size_t& size)
+{
+#ifdef PEAKCVBRIDGE_TURBOJPEG
+    const bool gray = image.type() == CV_8UC1;
+
+    if (nullptr != _handle && (gray || image.type() == CV_8UC3)) {
+        const int subsampling =
+          gray ? TJSAMP_GRAY : turbo_subsampling(settings.subsampling);
+
+        // worst case size, tjCompress2() never has to reallocate
+        const auto needed = tjBufSize(image.cols, image.rows, subsampling);
+        if (needed > _bufferSize) {
+            tjFree(_buffer);
+            _buffer = tjAlloc(static_cast<int>(needed));
+            _bufferSize = nullptr == _buffer ? 0 : needed;
+            if (nullptr == _buffer) {
+                fmt::println(stderr, "[jpeg] tjAlloc({}) failed", needed);
+                return false;
+            }
+        }
+
+        int flags = TJFLAG_NOREALLOC;
+        if (settings.fastDct)
+            flags |= TJFLAG_FASTDCT;
+
+        unsigned long jpegSize = _bufferSize;
+        if (0 != tjCompress2(_handle,
+                             image.data,
+                             image.cols,
+                             static_cast<int>(image.step),
+                             image.rows,
+                             gray ? TJPF_GRAY : TJPF_BGR,
+                             &_buffer,
+                             &jpegSize,
+                             subsampling,
+                             settings.quality,
+                             flags)) {
+            fmt::println(
+              stderr, "[jpeg] tjCompress2 failed: {}", tjGetErrorStr2(_handle));
+            return false;
+        }
+
+        data = _buffer;
+        size = jpegSize;
+        return true;
+    }
+#endif
+
+    try {
+        if (!cv::imencode(".jpg",
+                          image,
+                          _fallback,
+                          { cv::IMWRITE_JPEG_QUALITY, settings.quality }))
+            return false;
+    } catch (const cv::Exception& e) {
+        fmt::println(stderr, "[jpeg] cv::imencode failed: {}", e.what());
+        return false;
+    }
+
+    data = _fallback.data();
+    size = _fallback.size();
+    return true;
+}
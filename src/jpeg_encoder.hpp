@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+namespace XVII {
+
+struct JpegSettings
+{
+    // 1-100
+    int quality = 95;
+    // chroma subsampling of color images: 444, 422, 440, 420 or 411
+    int subsampling = 420;
+    // faster, slightly less accurate DCT
+    bool fastDct = false;
+};
+
+/**
+ *  JPEG encoder for use by a single thread. When built with
+ *  PEAKCVBRIDGE_TURBOJPEG, 8-bit gray and BGR images are encoded with
+ *  libjpeg-turbo, reusing one handle and an output buffer of the worst case
+ *  size, gray images as single component JPEGs. Everything else goes
+ *  through cv::imencode(), which ignores subsampling and fastDct.
+ */
+class JpegEncoder
+{
+  private:
+    // tjhandle
+    void* _handle = nullptr;
+    unsigned char* _buffer = nullptr;
+    unsigned long _bufferSize = 0;
+
+    std::vector<uchar> _fallback;
+
+  public:
+    JpegEncoder();
+    ~JpegEncoder();
+
+    JpegEncoder(const JpegEncoder&) = delete;
+    JpegEncoder& operator=(const JpegEncoder&) = delete;
+
+    /**
+     *  Encodes image, on success data and size describe the JPEG, which
+     *  stays valid until the next call.
+     */
+    bool encode(const cv::Mat& image,
+                const JpegSettings& settings,
+                const uchar*& data,
+                size_t& size);
+};
+
+}
@@ -1,17 +1,32 @@
 #include "lib.hpp"
+#include "frame_ring.hpp"
+#include "pixel_format.hpp"
+#include "trace.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include <fmt/core.h>
-#include <opencv2/imgproc.hpp>
 
 namespace cv {
 
 std::atomic_size_t PeakVideoCapture::_instanceCount(0);
 
+template<typename TNode>
 static bool
-isWriteable(std::shared_ptr<peak::core::nodes::Node> node)
+isWriteable(const CachedNode<TNode>& node)
 {
     using peak::core::nodes::NodeAccessStatus;
-    switch (node->AccessStatus()) {
+    switch (node.accessStatus()) {
         case NodeAccessStatus::WriteOnly:
         case NodeAccessStatus::ReadWrite:
             return true;
@@ -20,11 +35,12 @@ isWriteable(std::shared_ptr<peak::core::nodes::Node> node)
     }
 }
 
+template<typename TNode>
 static bool
-isReadable(std::shared_ptr<peak::core::nodes::Node> node)
+isReadable(const CachedNode<TNode>& node)
 {
     using peak::core::nodes::NodeAccessStatus;
-    switch (node->AccessStatus()) {
+    switch (node.accessStatus()) {
         case NodeAccessStatus::ReadOnly:
         case NodeAccessStatus::ReadWrite:
             return true;
@@ -33,9 +49,24 @@ isReadable(std::shared_ptr<peak::core::nodes::Node> node)
     }
 }
 
+/**
+ *  For nodes the device does not have, FindNode() raises the same
+ *  NotFoundException an uncached lookup would have.
+ */
+template<typename TNode>
+static const CachedNode<TNode>&
+require(const CachedNode<TNode>& node,
+        const std::shared_ptr<peak::core::NodeMap>& nodeMap)
+{
+    if (!node)
+        nodeMap->FindNode<TNode>(node.name());
+
+    return node;
+}
+
 template<typename TNode, typename TValue>
 static void
-nodeCheckedSetValue(TNode node, TValue value)
+nodeCheckedSetValue(const TNode& node, TValue value)
 {
     if (node->IncrementType() !=
         peak::core::nodes::NodeIncrementType::NoIncrement) {
@@ -48,6 +79,372 @@ nodeCheckedSetValue(TNode node, TValue value)
     node->SetValue(std::max(node->Minimum(), std::min(value, node->Maximum())));
 }
 
+static size_t
+roundUp(size_t value, size_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+/**
+ *  Maps memory for a user-allocated buffer of at least size bytes.
+ *  size is updated to the length of the mapping.
+ */
+static void*
+mapBufferMemory(size_t& size, PeakBufferAllocation allocation)
+{
+    constexpr size_t hugePageSize = 2 << 20;
+    const int prot = PROT_READ | PROT_WRITE;
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    size = roundUp(size, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+
+    void* ptr = MAP_FAILED;
+    switch (allocation) {
+        case PEAK_BUFFER_ALLOC_HUGEPAGES: {
+            size_t hugeSize = roundUp(size, hugePageSize);
+            ptr = mmap(nullptr, hugeSize, prot, flags | MAP_HUGETLB, -1, 0);
+            if (ptr != MAP_FAILED) {
+                size = hugeSize;
+                break;
+            }
+
+            // no hugetlbfs pages reserved, fall back to transparent hugepages
+            ptr = mmap(nullptr, size, prot, flags, -1, 0);
+            if (ptr != MAP_FAILED && madvise(ptr, size, MADV_HUGEPAGE) != 0)
+                fmt::println(stderr, "madvise failed: {}", strerror(errno));
+        } break;
+
+        case PEAK_BUFFER_ALLOC_LOCKED:
+            ptr = mmap(nullptr, size, prot, flags | MAP_POPULATE, -1, 0);
+            if (ptr != MAP_FAILED && mlock(ptr, size) != 0)
+                fmt::println(stderr,
+                             "mlock failed, buffer is not locked: {}",
+                             strerror(errno));
+            break;
+
+        default:
+            ptr = mmap(nullptr, size, prot, flags, -1, 0);
+            break;
+    }
+
+    return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+/**
+ *  Hands out cv::Mat headers that reference peak buffers directly. A buffer is
+ *  requeued to its data stream once the last cv::Mat referencing it is
+ *  released. After detach(), returned buffers are revoked instead, so leases
+ *  may safely outlive PeakVideoCapture::release().
+ */
+class BufferLeasePool
+  : public MatAllocator
+  , public std::enable_shared_from_this<BufferLeasePool>
+{
+  private:
+    struct Lease
+    {
+        std::shared_ptr<peak::core::Buffer> buffer;
+        // keeps the pool alive for as long as a buffer is leased
+        std::shared_ptr<const BufferLeasePool> pool;
+    };
+
+    mutable std::mutex _mutex;
+    mutable std::condition_variable _returned;
+    mutable std::shared_ptr<peak::core::DataStream> _dataStream;
+    mutable std::unordered_map<const UMatData*, Lease> _leases;
+    mutable BufferLeaseStatistics _statistics;
+    bool _detached = false;
+
+  public:
+    BufferLeasePool(std::shared_ptr<peak::core::DataStream> dataStream)
+      : _dataStream(std::move(dataStream))
+    {
+    }
+
+    // only wraps existing memory, anything else goes to the default allocator
+    UMatData* allocate(int dims,
+                       const int* sizes,
+                       int type,
+                       void* data,
+                       size_t* step,
+                       AccessFlag flags,
+                       UMatUsageFlags usageFlags) const override
+    {
+        return Mat::getDefaultAllocator()->allocate(
+          dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(UMatData* data,
+                  AccessFlag accessflags,
+                  UMatUsageFlags usageFlags) const override
+    {
+        return Mat::getDefaultAllocator()->allocate(
+          data, accessflags, usageFlags);
+    }
+
+    void deallocate(UMatData* u) const override
+    {
+        std::shared_ptr<const BufferLeasePool> keepAlive;
+        {
+            std::lock_guard lock(_mutex);
+
+            auto it = _leases.find(u);
+            if (it == _leases.end()) {
+                // not one of ours
+                delete u;
+                return;
+            }
+
+            keepAlive = std::move(it->second.pool);
+            auto buffer = std::move(it->second.buffer);
+            _leases.erase(it);
+            _statistics.active = _leases.size();
+
+            try {
+                if (_detached) {
+                    _dataStream->RevokeBuffer(buffer);
+                    if (_leases.empty())
+                        _dataStream = nullptr;
+                } else
+                    _dataStream->QueueBuffer(buffer);
+            } catch (const std::exception& e) {
+                fmt::println(
+                  stderr, "Returning leased buffer failed: {}", e.what());
+            }
+        }
+
+        _returned.notify_all();
+        delete u;
+    }
+
+    Mat lease(std::shared_ptr<peak::core::Buffer> buffer,
+              int rows,
+              int cols,
+              int type,
+              size_t step)
+    {
+        Mat mat(rows, cols, type, buffer->BasePtr(), step);
+
+        auto u = new UMatData(this);
+        u->data = u->origdata = mat.data;
+        u->size = mat.total() * mat.elemSize();
+        u->refcount = 1;
+
+        {
+            std::lock_guard lock(_mutex);
+
+            _leases.emplace(u, Lease{ std::move(buffer), shared_from_this() });
+            _statistics.active = _leases.size();
+            _statistics.peak = std::max(_statistics.peak, _statistics.active);
+            _statistics.total++;
+        }
+
+        mat.u = u;
+        return mat;
+    }
+
+    /**
+     *  Waits until fewer than numBuffers buffers are leased.
+     *  Returns false if that did not happen within timeoutMs.
+     */
+    bool waitForAvailable(size_t numBuffers, uint64_t timeoutMs) const
+    {
+        std::unique_lock lock(_mutex);
+
+        auto available = [&]() { return _leases.size() < numBuffers; };
+
+        bool ok;
+        if (timeoutMs == peak::core::Timeout::INFINITE_TIMEOUT) {
+            _returned.wait(lock, available);
+            ok = true;
+        } else
+            ok = _returned.wait_for(
+              lock, std::chrono::milliseconds(timeoutMs), available);
+
+        if (!ok)
+            _statistics.refused++;
+
+        return ok;
+    }
+
+    bool tryAcquire(size_t numBuffers) const
+    {
+        std::lock_guard lock(_mutex);
+
+        if (_leases.size() < numBuffers)
+            return true;
+
+        _statistics.refused++;
+        return false;
+    }
+
+    /**
+     *  Revokes every announced buffer that is not leased and detaches from
+     *  the data stream. Under one lock, a buffer returned meanwhile is either
+     *  revoked here or by deallocate(), never queued again.
+     */
+    void detach()
+    {
+        std::lock_guard lock(_mutex);
+
+        for (const auto& buffer : _dataStream->AnnouncedBuffers()) {
+            auto leased = std::any_of(
+              _leases.begin(), _leases.end(), [&buffer](const auto& lease) {
+                  return lease.second.buffer == buffer;
+              });
+            if (!leased)
+                _dataStream->RevokeBuffer(buffer);
+        }
+
+        _detached = true;
+        if (_leases.empty())
+            _dataStream = nullptr;
+    }
+
+    BufferLeaseStatistics statistics() const
+    {
+        std::lock_guard lock(_mutex);
+
+        return _statistics;
+    }
+};
+
+/**
+ *  Drains finished buffers from a data stream on a dedicated thread, so that
+ *  a slow consumer does not leave them queued up inside the SDK. Buffers are
+ *  passed to the consumer by their index in the announced buffer list.
+ */
+class AcquisitionThread
+{
+  private:
+    // bounds the latency of stopping the thread if KillWait() is missed
+    static constexpr uint64_t WAIT_TIMEOUT_MS = 100;
+
+    std::shared_ptr<peak::core::DataStream> _dataStream;
+    std::vector<std::shared_ptr<peak::core::Buffer>> _buffers;
+    PeakAcquisitionMode _mode;
+
+    SpscRing<uint32_t> _ring;
+    LatestSlot _latest;
+
+    std::atomic_bool _stop = false;
+    std::atomic_size_t _dropped = 0;
+
+    // only used to sleep while there is nothing to consume
+    std::mutex _mutex;
+    std::condition_variable _published;
+
+    std::thread _thread;
+
+    uint32_t indexOf(const std::shared_ptr<peak::core::Buffer>& buffer) const
+    {
+        for (size_t i = 0; i < _buffers.size(); i++)
+            if (_buffers[i] == buffer)
+                return static_cast<uint32_t>(i);
+
+        return LatestSlot::EMPTY;
+    }
+
+    bool tryTake(uint32_t& index)
+    {
+        if (_mode == PEAK_ACQUISITION_LATEST)
+            return LatestSlot::EMPTY != (index = _latest.take());
+
+        return _ring.pop(index);
+    }
+
+    void run()
+    {
+        while (!_stop.load(std::memory_order_relaxed)) {
+            std::shared_ptr<peak::core::Buffer> buffer;
+            try {
+                buffer = _dataStream->WaitForFinishedBuffer(WAIT_TIMEOUT_MS);
+            } catch (const peak::core::TimeoutException&) {
+                continue;
+            } catch (const peak::core::AbortedException&) {
+                continue;
+            } catch (const std::exception& e) {
+                fmt::println(stderr, "Acquisition thread failed: {}", e.what());
+                break;
+            }
+
+            auto index = indexOf(buffer);
+            if (LatestSlot::EMPTY == index) {
+                // announced after the thread was started, should not happen
+                _dataStream->QueueBuffer(buffer);
+                continue;
+            }
+
+            if (_mode == PEAK_ACQUISITION_LATEST) {
+                auto stale = _latest.publish(index);
+                if (LatestSlot::EMPTY != stale) {
+                    _dataStream->QueueBuffer(_buffers[stale]);
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            } else if (!_ring.push(index)) {
+                // cannot happen, the ring holds every announced buffer
+                _dataStream->QueueBuffer(buffer);
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            {
+                std::lock_guard lock(_mutex);
+            }
+            _published.notify_one();
+        }
+    }
+
+  public:
+    AcquisitionThread(std::shared_ptr<peak::core::DataStream> dataStream,
+                      PeakAcquisitionMode mode)
+      : _dataStream(std::move(dataStream))
+      , _buffers(_dataStream->AnnouncedBuffers())
+      , _mode(mode)
+      , _ring(_buffers.size())
+    {
+        _thread = std::thread(&AcquisitionThread::run, this);
+    }
+
+    ~AcquisitionThread()
+    {
+        _stop.store(true);
+        try {
+            _dataStream->KillWait();
+        } catch (...) {
+        }
+
+        if (_thread.joinable())
+            _thread.join();
+
+        // hand undelivered buffers back to the data stream
+        uint32_t index;
+        while (tryTake(index))
+            _dataStream->QueueBuffer(_buffers[index]);
+    }
+
+    /**
+     *  Returns the next buffer, or nullptr if none arrived within timeoutMs.
+     */
+    std::shared_ptr<peak::core::Buffer> wait(uint64_t timeoutMs)
+    {
+        uint32_t index;
+        if (!tryTake(index)) {
+            std::unique_lock lock(_mutex);
+            auto available = [&]() { return tryTake(index); };
+
+            if (timeoutMs == peak::core::Timeout::INFINITE_TIMEOUT)
+                _published.wait(lock, available);
+            else if (!_published.wait_for(
+                       lock, std::chrono::milliseconds(timeoutMs), available))
+                return nullptr;
+        }
+
+        return _buffers[index];
+    }
+
+    size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+};
+
 PeakVideoCapture::PeakVideoCapture(bool debayer, uint64_t bufferTimeout)
   : VideoCapture()
 {
@@ -57,7 +454,7 @@ PeakVideoCapture::PeakVideoCapture(bool debayer, uint64_t bufferTimeout)
           stderr, "Peak Version: {}", peak::Library::Version().ToString());
     }
     _bufferTimeout = bufferTimeout;
-    _debayer = debayer;
+    _debayerMode = debayer ? PEAK_DEBAYER_FULL : PEAK_DEBAYER_NONE;
 }
 
 PeakVideoCapture::PeakVideoCapture(int index,
@@ -114,20 +511,11 @@ PeakVideoCapture::open(int _index, int _apiPreference)
 
         _dataStream = dataStreams.at(0)->OpenDataStream();
         _nodeMap = _device->RemoteDevice()->NodeMaps().at(0);
-
-        int64_t payloadSize =
-          _nodeMap->FindNode<peak::core::nodes::IntegerNode>("PayloadSize")
-            ->Value();
+        resolveNodes();
 
         _dataStream->Flush(peak::core::DataStreamFlushMode::DiscardAll);
-        size_t numBuffersMinRequired =
-          _dataStream->NumBuffersAnnouncedMinRequired();
-
-        for (size_t i = 0; i < numBuffersMinRequired; i++) {
-            auto buffer = _dataStream->AllocAndAnnounceBuffer(
-              static_cast<size_t>(payloadSize), nullptr);
-            _dataStream->QueueBuffer(buffer);
-        }
+        if (!announceBuffers())
+            return false;
 
         try {
             _nodeMap
@@ -146,17 +534,22 @@ PeakVideoCapture::open(int _index, int _apiPreference)
                 ->CurrentEntry()
                 ->StringValue();
 
-            if (pixfmtStr == "Mono8")
-                _pixelFormat = Mono8;
-            else if (pixfmtStr == "BayerRG8")
-                _pixelFormat = BayerRG8;
-            else
+            const auto* format = findPixelFormat(pixfmtStr);
+            _pixelFormat =
+              format ? format->format : PEAK_PIXEL_FORMAT_UNKNOWN;
+
+            if (nullptr == format)
                 fmt::println(stderr, "Unknown pixel format: {}", pixfmtStr);
         } catch (const std::exception& e) {
             fmt::println(stderr, "Querying PixelFormat failed: {}", e.what());
         }
 
-        return true;
+        // only when asked for, the nodes stay as the user set left them
+        if (_chunks)
+            setChunkMode(true);
+
+        // the user set and the chunks may both have changed PayloadSize
+        return reannounceBuffersIfNeeded();
 
     } catch (const peak::core::InternalErrorException& iee) {
         if (throwOnFail)
@@ -172,6 +565,24 @@ PeakVideoCapture::open(int _index, int _apiPreference)
     return false;
 }
 
+int
+PeakVideoCapture::cameraIndex(const std::string& serialNumber) const
+{
+    try {
+        auto& deviceManager = peak::DeviceManager::Instance();
+        deviceManager.Update();
+
+        const auto devices = deviceManager.Devices();
+        for (size_t i = 0; i < devices.size(); i++)
+            if (devices[i]->SerialNumber() == serialNumber)
+                return static_cast<int>(i);
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Updating the device list failed: {}", e.what());
+    }
+
+    return -1;
+}
+
 void
 PeakVideoCapture::release()
 {
@@ -183,13 +594,10 @@ PeakVideoCapture::release()
         }
     }
 
-    if (_dataStream) {
-        _dataStream->Flush(peak::core::DataStreamFlushMode::DiscardAll);
+    if (_dataStream)
+        revokeBuffers();
 
-        for (const auto& buffer : _dataStream->AnnouncedBuffers()) {
-            _dataStream->RevokeBuffer(buffer);
-        }
-    }
+    resetNodes();
 
     // reverse order is probably important
     _dataStream = nullptr;
@@ -197,6 +605,263 @@ PeakVideoCapture::release()
     _device = nullptr;
 }
 
+void
+PeakVideoCapture::resolveNodes()
+{
+    _nodes.exposureAuto.resolve(_nodeMap, "ExposureAuto");
+    _nodes.exposureTime.resolve(_nodeMap, "ExposureTime");
+    _nodes.gain.resolve(_nodeMap, "Gain");
+    _nodes.acquisitionFrameRate.resolve(_nodeMap, "AcquisitionFrameRate");
+    _nodes.acquisitionFrameRateTarget.resolve(_nodeMap,
+                                              "AcquisitionFrameRateTarget");
+    _nodes.acquisitionFrameRateTargetEnable.resolve(
+      _nodeMap, "AcquisitionFrameRateTargetEnable");
+    _nodes.triggerMode.resolve(_nodeMap, "TriggerMode");
+    _nodes.triggerSource.resolve(_nodeMap, "TriggerSource");
+    _nodes.triggerActivation.resolve(_nodeMap, "TriggerActivation");
+    _nodes.width.resolve(_nodeMap, "Width");
+    _nodes.height.resolve(_nodeMap, "Height");
+    _nodes.offsetX.resolve(_nodeMap, "OffsetX");
+    _nodes.offsetY.resolve(_nodeMap, "OffsetY");
+    _nodes.binningHorizontal.resolve(_nodeMap, "BinningHorizontal");
+    _nodes.binningVertical.resolve(_nodeMap, "BinningVertical");
+    _nodes.decimationHorizontal.resolve(_nodeMap, "DecimationHorizontal");
+    _nodes.decimationVertical.resolve(_nodeMap, "DecimationVertical");
+    _nodes.payloadSize.resolve(_nodeMap, "PayloadSize");
+    _nodes.tlParamsLocked.resolve(_nodeMap, "TLParamsLocked");
+    _nodes.acquisitionStart.resolve(_nodeMap, "AcquisitionStart");
+    _nodes.acquisitionStop.resolve(_nodeMap, "AcquisitionStop");
+    _nodes.chunkExposureTime.resolve(_nodeMap, "ChunkExposureTime");
+    _nodes.chunkGain.resolve(_nodeMap, "ChunkGain");
+}
+
+void
+PeakVideoCapture::resetNodes()
+{
+    _nodes = {};
+}
+
+void
+PeakVideoCapture::invalidateNodeAccess() const
+{
+    _nodes.exposureAuto.invalidate();
+    _nodes.exposureTime.invalidate();
+    _nodes.gain.invalidate();
+    _nodes.acquisitionFrameRate.invalidate();
+    _nodes.acquisitionFrameRateTarget.invalidate();
+    _nodes.acquisitionFrameRateTargetEnable.invalidate();
+    _nodes.triggerMode.invalidate();
+    _nodes.triggerSource.invalidate();
+    _nodes.triggerActivation.invalidate();
+    _nodes.width.invalidate();
+    _nodes.height.invalidate();
+    _nodes.offsetX.invalidate();
+    _nodes.offsetY.invalidate();
+    _nodes.binningHorizontal.invalidate();
+    _nodes.binningVertical.invalidate();
+    _nodes.decimationHorizontal.invalidate();
+    _nodes.decimationVertical.invalidate();
+    _nodes.payloadSize.invalidate();
+    _nodes.tlParamsLocked.invalidate();
+    _nodes.acquisitionStart.invalidate();
+    _nodes.acquisitionStop.invalidate();
+    _nodes.chunkExposureTime.invalidate();
+    _nodes.chunkGain.invalidate();
+}
+
+const CachedNode<peak::core::nodes::IntegerNode>*
+PeakVideoCapture::imageFormatNode(int propId) const
+{
+    switch (propId) {
+        case cv::CAP_PROP_FRAME_WIDTH:
+            return &_nodes.width;
+        case cv::CAP_PROP_FRAME_HEIGHT:
+            return &_nodes.height;
+        case CAP_PROP_PEAK_OFFSET_X:
+            return &_nodes.offsetX;
+        case CAP_PROP_PEAK_OFFSET_Y:
+            return &_nodes.offsetY;
+        case CAP_PROP_PEAK_BINNING_HORIZONTAL:
+            return &_nodes.binningHorizontal;
+        case CAP_PROP_PEAK_BINNING_VERTICAL:
+            return &_nodes.binningVertical;
+        case CAP_PROP_PEAK_DECIMATION_HORIZONTAL:
+            return &_nodes.decimationHorizontal;
+        case CAP_PROP_PEAK_DECIMATION_VERTICAL:
+            return &_nodes.decimationVertical;
+        default:
+            return nullptr;
+    }
+}
+
+bool
+PeakVideoCapture::announceBuffers()
+{
+    _leasePool = std::make_shared<BufferLeasePool>(_dataStream);
+
+    auto payloadSize =
+      static_cast<size_t>(require(_nodes.payloadSize, _nodeMap)->Value());
+    _payloadSize = payloadSize;
+
+    size_t numBuffers = std::max(
+      static_cast<size_t>(_dataStream->NumBuffersAnnouncedMinRequired()),
+      _numBuffers);
+
+    for (size_t i = 0; i < numBuffers; i++) {
+        std::shared_ptr<peak::core::Buffer> buffer;
+
+        if (_bufferAllocation == PEAK_BUFFER_ALLOC_SDK)
+            buffer = _dataStream->AllocAndAnnounceBuffer(payloadSize, nullptr);
+        else {
+            size_t mappedSize = payloadSize;
+            void* memory = mapBufferMemory(mappedSize, _bufferAllocation);
+            if (nullptr == memory) {
+                if (throwOnFail)
+                    CV_Error(Error::StsNoMem, "Allocating buffer failed");
+
+                return false;
+            }
+
+            buffer = _dataStream->AnnounceBuffer(
+              memory,
+              payloadSize,
+              nullptr,
+              [mappedSize](void* buffer, void* userPtr) {
+                  munmap(buffer, mappedSize);
+              });
+        }
+
+        _dataStream->QueueBuffer(buffer);
+    }
+
+    return true;
+}
+
+void
+PeakVideoCapture::revokeBuffers()
+{
+    _dataStream->Flush(peak::core::DataStreamFlushMode::DiscardAll);
+
+    // leased buffers are revoked by the pool once they are returned
+    if (_leasePool) {
+        _leasePool->detach();
+        _leasePool = nullptr;
+        return;
+    }
+
+    for (const auto& buffer : _dataStream->AnnouncedBuffers())
+        _dataStream->RevokeBuffer(buffer);
+}
+
+/**
+ *  Buffers are sized for the PayloadSize at the time they were announced, so
+ *  they have to be reallocated once a node write changed it.
+ */
+bool
+PeakVideoCapture::reannounceBuffersIfNeeded()
+{
+    auto payloadSize =
+      static_cast<size_t>(require(_nodes.payloadSize, _nodeMap)->Value());
+
+    if (payloadSize == _payloadSize)
+        return true;
+
+    if (_isAcquiring)
+        stopAcquisition();
+
+    _filledBuffer = nullptr;
+    revokeBuffers();
+    return announceBuffers();
+}
+
+/**
+ *  Announces buffers for the current settings in place of the announced
+ *  ones. If that fails, restore() reverts the settings and their buffers are
+ *  announced again, so that a failed set() leaves a working capture. With
+ *  restart, acquisition is restarted afterwards, even if announcing threw.
+ */
+bool
+PeakVideoCapture::replaceBuffers(bool restart,
+                                 const std::function<void()>& restore)
+{
+    _filledBuffer = nullptr;
+    revokeBuffers();
+
+    std::exception_ptr error;
+    bool announced = false;
+    try {
+        announced = announceBuffers();
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    if (!announced) {
+        // some of the new buffers may have been announced already
+        revokeBuffers();
+        restore();
+        announceBuffers();
+    }
+
+    if (restart)
+        startAcquisition();
+
+    if (error)
+        std::rethrow_exception(error);
+
+    return announced;
+}
+
+void
+PeakVideoCapture::setChunkMode(bool enable)
+{
+    using namespace peak::core::nodes;
+
+    if (!_nodeMap->HasNode("ChunkModeActive"))
+        return;
+
+    try {
+        auto selector = _nodeMap->FindNode<EnumerationNode>("ChunkSelector");
+        auto chunkEnable = _nodeMap->FindNode<BooleanNode>("ChunkEnable");
+
+        for (const char* chunk : { "ExposureTime", "Gain" }) {
+            if (!selector->HasEntry(chunk))
+                continue;
+
+            selector->SetCurrentEntry(chunk);
+            chunkEnable->SetValue(enable);
+        }
+
+        _nodeMap->FindNode<BooleanNode>("ChunkModeActive")->SetValue(enable);
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Setting chunk mode failed: {}", e.what());
+    }
+
+    invalidateNodeAccess();
+}
+
+void
+PeakVideoCapture::updateFrameMetadata()
+{
+    _frameMetadata = {};
+    _frameMetadata.frameId = _filledBuffer->FrameID();
+    _frameMetadata.timestampNs = _filledBuffer->Timestamp_ns();
+    _frameMetadata.incomplete = _filledBuffer->IsIncomplete();
+
+    if (!_chunks || !_filledBuffer->HasChunks())
+        return;
+
+    try {
+        _nodeMap->UpdateChunkNodes(_filledBuffer);
+
+        if (_nodes.chunkExposureTime)
+            _frameMetadata.exposureTime = _nodes.chunkExposureTime->Value();
+        if (_nodes.chunkGain)
+            _frameMetadata.gain = _nodes.chunkGain->Value();
+    } catch (const std::exception& e) {
+        fmt::println(stderr, "Reading chunk data failed: {}", e.what());
+    }
+}
+
 bool
 PeakVideoCapture::isOpened() const
 {
@@ -206,10 +871,48 @@ PeakVideoCapture::isOpened() const
 bool
 PeakVideoCapture::grab()
 {
+    PEAKCVBRIDGE_SPAN("grab");
+
     if (!_isAcquiring) {
         startAcquisition();
     }
 
+    if (_zeroCopy && _leasePool) {
+        // with every buffer leased, the camera has nothing to fill
+        const auto numBuffers =
+          static_cast<size_t>(_dataStream->NumBuffersAnnounced());
+        bool available =
+          _leaseBlocking
+            ? _leasePool->waitForAvailable(numBuffers, _bufferTimeout)
+            : _leasePool->tryAcquire(numBuffers);
+
+        if (!available) {
+            if (throwOnFail)
+                CV_Error(Error::StsError, "All buffers are leased");
+
+            return false;
+        }
+    }
+
+    if (_filledBuffer) {
+        // grabbed but never retrieved
+        _dataStream->QueueBuffer(_filledBuffer);
+        _filledBuffer = nullptr;
+    }
+
+    if (_acquisitionThread) {
+        _filledBuffer = _acquisitionThread->wait(_bufferTimeout);
+        if (nullptr == _filledBuffer) {
+            if (throwOnFail)
+                CV_Error(Error::StsError, "Timeout while waiting for buffer");
+
+            return false;
+        }
+
+        updateFrameMetadata();
+        return true;
+    }
+
     try {
         _filledBuffer = _dataStream->WaitForFinishedBuffer(_bufferTimeout);
     } catch (const peak::core::TimeoutException& te) {
@@ -219,43 +922,76 @@ PeakVideoCapture::grab()
         return false;
     }
 
+    updateFrameMetadata();
     return true;
 }
 
 bool
 PeakVideoCapture::retrieve(OutputArray image, int flag)
 {
+    PEAKCVBRIDGE_SPAN("retrieve");
+
     if (nullptr == _filledBuffer) {
         cv::Mat empty;
         empty.copyTo(image);
         return false;
     }
 
-    cv::Mat ref(_filledBuffer->Height(),
-                _filledBuffer->Width(),
-                CV_8UC1,
-                _filledBuffer->BasePtr(),
-                _filledBuffer->Width());
-    if (!_debayer || _pixelFormat == UNKNOWN || _pixelFormat == Mono8)
-        ref.copyTo(image);
-    else {
-        int code;
-        switch (_pixelFormat) {
-        case BayerRG8:
-            code = cv::COLOR_BayerRG2BGR;
-            break;
-        default:
-            __builtin_unreachable();
-        }
-        cv::cvtColor(ref, image, code);
+    const int rows = static_cast<int>(_filledBuffer->Height());
+    const int cols = static_cast<int>(_filledBuffer->Width());
+    void* data = _filledBuffer->BasePtr();
+
+    // unlisted formats come out as their first rows x cols bytes, as before
+    // pixel formats were told apart
+    static const PixelFormatDescription unlisted = {
+        "", PEAK_PIXEL_FORMAT_UNKNOWN, PixelPacking::None8, false
+    };
+
+    const auto* format = describePixelFormat(_pixelFormat);
+    if (nullptr == format)
+        format = &unlisted;
+
+    if (_filledBuffer->Size() <
+        packedSize(format->packing, static_cast<size_t>(rows) * cols)) {
+        _dataStream->QueueBuffer(_filledBuffer);
+        _filledBuffer = nullptr;
+
+        if (throwOnFail)
+            CV_Error(Error::StsUnsupportedFormat, "Buffer smaller than frame");
+
+        return false;
     }
 
+    const bool debayer = format->bayer && _debayerMode != PEAK_DEBAYER_NONE;
+    const int type = rawImageType(*format, _convert8Bit);
+
+    if (type >= 0 && !debayer && _zeroCopy && _leasePool) {
+        // the pool requeues the buffer once the image is released
+        image.assign(_leasePool->lease(std::move(_filledBuffer),
+                                       rows,
+                                       cols,
+                                       type,
+                                       cols * CV_ELEM_SIZE(type)));
+        _filledBuffer = nullptr;
+        return true;
+    }
+
+    convertRawFrame(
+      data, rows, cols, *format, _debayerMode, _convert8Bit, _unpacked, image);
+
     _dataStream->QueueBuffer(_filledBuffer);
     _filledBuffer = nullptr;
 
     return true;
 }
 
+bool
+PeakVideoCapture::retrieve(OutputArray image, FrameMetadata& metadata)
+{
+    metadata = _frameMetadata;
+    return retrieve(image);
+}
+
 bool
 PeakVideoCapture::read(OutputArray image)
 {
@@ -266,17 +1002,149 @@ PeakVideoCapture::read(OutputArray image)
     return retrieve(image);
 }
 
+BufferLeaseStatistics
+PeakVideoCapture::leaseStatistics() const
+{
+    if (!_leasePool)
+        return {};
+
+    return _leasePool->statistics();
+}
+
+BufferPoolOccupancy
+PeakVideoCapture::bufferPoolOccupancy() const
+{
+    if (!_dataStream)
+        return {};
+
+    BufferPoolOccupancy occupancy;
+    occupancy.announced =
+      static_cast<size_t>(_dataStream->NumBuffersAnnounced());
+    occupancy.queued = static_cast<size_t>(_dataStream->NumBuffersQueued());
+    occupancy.awaitDelivery =
+      static_cast<size_t>(_dataStream->NumBuffersAwaitDelivery());
+    occupancy.leased = leaseStatistics().active;
+    occupancy.underruns = static_cast<size_t>(_dataStream->NumUnderruns());
+
+    return occupancy;
+}
+
+bool
+PeakVideoCapture::rawFrame(RawFrame& frame) const
+{
+    if (nullptr == _filledBuffer)
+        return false;
+
+    frame.data = _filledBuffer->BasePtr();
+    frame.width = static_cast<int>(_filledBuffer->Width());
+    frame.height = static_cast<int>(_filledBuffer->Height());
+    frame.pixelFormat = _pixelFormat;
+
+    // buffers are sized for PayloadSize, which includes the chunk data
+    const auto* format = describePixelFormat(_pixelFormat);
+    frame.size =
+      format ? std::min(_filledBuffer->Size(),
+                        packedSize(format->packing,
+                                   static_cast<size_t>(frame.width) *
+                                     static_cast<size_t>(frame.height)))
+             : _filledBuffer->Size();
+
+    return true;
+}
+
+const FrameMetadata&
+PeakVideoCapture::frameMetadata() const
+{
+    return _frameMetadata;
+}
+
+FrameCounters
+PeakVideoCapture::frameCounters() const
+{
+    FrameCounters counters;
+    counters.dropped =
+      _framesDropped + (_acquisitionThread ? _acquisitionThread->dropped() : 0);
+
+    if (!_dataStream)
+        return counters;
+
+    counters.delivered =
+      static_cast<size_t>(_dataStream->NumBuffersDelivered());
+    counters.lost = static_cast<size_t>(_dataStream->NumBuffersLost());
+    counters.incomplete =
+      static_cast<size_t>(_dataStream->NumBuffersIncomplete());
+    counters.underruns = static_cast<size_t>(_dataStream->NumUnderruns());
+
+    return counters;
+}
+
 double
 PeakVideoCapture::get(int propId) const
 {
+    switch (propId) {
+        case CAP_PROP_PEAK_ZERO_COPY:
+            return _zeroCopy;
+        case CAP_PROP_PEAK_LEASE_BLOCKING:
+            return _leaseBlocking;
+        case CAP_PROP_PEAK_LEASES_ACTIVE:
+            return static_cast<double>(leaseStatistics().active);
+        case CAP_PROP_PEAK_LEASES_PEAK:
+            return static_cast<double>(leaseStatistics().peak);
+        case CAP_PROP_PEAK_LEASES_TOTAL:
+            return static_cast<double>(leaseStatistics().total);
+        case CAP_PROP_PEAK_LEASES_REFUSED:
+            return static_cast<double>(leaseStatistics().refused);
+        case cv::CAP_PROP_BUFFERSIZE:
+            return static_cast<double>(_numBuffers);
+        case CAP_PROP_PEAK_BUFFER_ALLOCATION:
+            return _bufferAllocation;
+        case CAP_PROP_PEAK_BUFFERS_ANNOUNCED:
+            return static_cast<double>(bufferPoolOccupancy().announced);
+        case CAP_PROP_PEAK_BUFFERS_QUEUED:
+            return static_cast<double>(bufferPoolOccupancy().queued);
+        case CAP_PROP_PEAK_BUFFERS_AWAIT_DELIVERY:
+            return static_cast<double>(bufferPoolOccupancy().awaitDelivery);
+        case CAP_PROP_PEAK_BUFFER_UNDERRUNS:
+            return static_cast<double>(bufferPoolOccupancy().underruns);
+        case CAP_PROP_PEAK_ACQUISITION_MODE:
+            return _acquisitionMode;
+        case CAP_PROP_PEAK_FRAMES_DROPPED:
+            return static_cast<double>(frameCounters().dropped);
+        case CAP_PROP_PEAK_FRAMES_DELIVERED:
+            return static_cast<double>(frameCounters().delivered);
+        case CAP_PROP_PEAK_FRAMES_LOST:
+            return static_cast<double>(frameCounters().lost);
+        case CAP_PROP_PEAK_FRAMES_INCOMPLETE:
+            return static_cast<double>(frameCounters().incomplete);
+        case cv::CAP_PROP_POS_MSEC:
+            return static_cast<double>(_frameMetadata.timestampNs) / 1e6;
+        case CAP_PROP_PEAK_FRAME_ID:
+            return static_cast<double>(_frameMetadata.frameId);
+        case CAP_PROP_PEAK_CHUNKS:
+            return _chunks;
+        case CAP_PROP_PEAK_CHUNK_EXPOSURE:
+            return _frameMetadata.exposureTime.value_or(0.0);
+        case CAP_PROP_PEAK_CHUNK_GAIN:
+            return _frameMetadata.gain.value_or(0.0);
+        case CAP_PROP_PEAK_DEBAYER_MODE:
+            return _debayerMode;
+        case CAP_PROP_PEAK_PIXEL_FORMAT:
+            return _pixelFormat;
+        case CAP_PROP_PEAK_CONVERT_8BIT:
+            return _convert8Bit;
+        case CAP_PROP_PEAK_PAYLOAD_SIZE:
+            return static_cast<double>(_payloadSize);
+    }
+
+    if (!isOpened())
+        return 0;
+
     try {
 
         switch (propId) {
 
             case cv::CAP_PROP_AUTO_EXPOSURE: {
-                auto node =
-                  _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                    "ExposureAuto");
+                const auto& node = require(_nodes.exposureAuto, _nodeMap);
 
                 if (!isReadable(node))
                     return 0;
@@ -285,8 +1153,16 @@ PeakVideoCapture::get(int propId) const
             }
 
             case cv::CAP_PROP_EXPOSURE: {
-                auto node = _nodeMap->FindNode<peak::core::nodes::FloatNode>(
-                  "ExposureTime");
+                const auto& node = require(_nodes.exposureTime, _nodeMap);
+
+                if (!isReadable(node))
+                    return 0;
+
+                return node->Value();
+            }
+
+            case cv::CAP_PROP_GAIN: {
+                const auto& node = require(_nodes.gain, _nodeMap);
 
                 if (!isReadable(node))
                     return 0;
@@ -295,8 +1171,8 @@ PeakVideoCapture::get(int propId) const
             }
 
             case cv::CAP_PROP_FPS: {
-                auto node = _nodeMap->FindNode<peak::core::nodes::FloatNode>(
-                  "AcquisitionFrameRate");
+                const auto& node =
+                  require(_nodes.acquisitionFrameRate, _nodeMap);
 
                 if (!isReadable(node))
                     return 0;
@@ -305,15 +1181,29 @@ PeakVideoCapture::get(int propId) const
             }
 
             case cv::CAP_PROP_TRIGGER: {
-                auto node =
-                  _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                    "TriggerMode");
+                const auto& node = require(_nodes.triggerMode, _nodeMap);
 
                 if (!isReadable(node))
                     return 0;
 
                 return node->CurrentEntry()->StringValue() == "On";
             }
+
+            case cv::CAP_PROP_FRAME_WIDTH:
+            case cv::CAP_PROP_FRAME_HEIGHT:
+            case CAP_PROP_PEAK_OFFSET_X:
+            case CAP_PROP_PEAK_OFFSET_Y:
+            case CAP_PROP_PEAK_BINNING_HORIZONTAL:
+            case CAP_PROP_PEAK_BINNING_VERTICAL:
+            case CAP_PROP_PEAK_DECIMATION_HORIZONTAL:
+            case CAP_PROP_PEAK_DECIMATION_VERTICAL: {
+                const auto& node = require(*imageFormatNode(propId), _nodeMap);
+
+                if (!isReadable(node))
+                    return 0;
+
+                return static_cast<double>(node->Value());
+            }
         }
 
     } catch (const peak::core::NotFoundException& nfe) {
@@ -327,17 +1217,183 @@ PeakVideoCapture::get(int propId) const
 bool
 PeakVideoCapture::set(int propId, double value)
 {
-    if (_isAcquiring)
+    switch (propId) {
+        case CAP_PROP_PEAK_ZERO_COPY:
+            _zeroCopy = 0.0 != value;
+            return true;
+
+        case CAP_PROP_PEAK_LEASE_BLOCKING:
+            _leaseBlocking = 0.0 != value;
+            return true;
+
+        case cv::CAP_PROP_BUFFERSIZE:
+        case CAP_PROP_PEAK_BUFFER_ALLOCATION: {
+            if (value < 0.0 || (propId == CAP_PROP_PEAK_BUFFER_ALLOCATION &&
+                                value > PEAK_BUFFER_ALLOC_LOCKED)) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            const auto numBuffers = _numBuffers;
+            const auto bufferAllocation = _bufferAllocation;
+
+            if (propId == cv::CAP_PROP_BUFFERSIZE)
+                _numBuffers = static_cast<size_t>(value);
+            else
+                _bufferAllocation =
+                  static_cast<PeakBufferAllocation>(static_cast<int>(value));
+
+            if (!isOpened())
+                return true;
+
+            const bool restart = _isAcquiring;
+            if (restart)
+                stopAcquisition();
+
+            return replaceBuffers(restart, [&]() {
+                _numBuffers = numBuffers;
+                _bufferAllocation = bufferAllocation;
+            });
+        }
+
+        case CAP_PROP_PEAK_ACQUISITION_MODE: {
+            if (value < PEAK_ACQUISITION_INLINE ||
+                value > PEAK_ACQUISITION_LOSSLESS) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            // the acquisition thread is created by startAcquisition()
+            const bool restart = _isAcquiring;
+            if (restart)
+                stopAcquisition();
+
+            _acquisitionMode =
+              static_cast<PeakAcquisitionMode>(static_cast<int>(value));
+
+            if (restart)
+                startAcquisition();
+
+            return true;
+        }
+
+        case CAP_PROP_PEAK_DEBAYER_MODE: {
+            if (value < PEAK_DEBAYER_NONE || value > PEAK_DEBAYER_HALF) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            _debayerMode =
+              static_cast<PeakDebayerMode>(static_cast<int>(value));
+            return true;
+        }
+
+        case CAP_PROP_PEAK_CONVERT_8BIT:
+            _convert8Bit = 0.0 != value;
+            return true;
+
+        case CAP_PROP_PEAK_CHUNKS: {
+            const bool chunks = _chunks;
+            _chunks = 0.0 != value;
+
+            if (!isOpened())
+                return true;
+
+            // chunk mode is locked while acquiring
+            const bool restart = _isAcquiring;
+            if (restart)
+                stopAcquisition();
+
+            setChunkMode(_chunks);
+
+            const auto payloadSize = static_cast<size_t>(
+              require(_nodes.payloadSize, _nodeMap)->Value());
+            if (payloadSize == _payloadSize) {
+                if (restart)
+                    startAcquisition();
+
+                return true;
+            }
+
+            return replaceBuffers(restart, [&]() {
+                _chunks = chunks;
+                setChunkMode(chunks);
+            });
+        }
+    }
+
+    if (!isOpened()) {
+        if (throwOnFail)
+            CV_Error(Error::StsError, "Capture is not opened");
+
+        return false;
+    }
+
+    // writes may change the access status of other nodes
+    invalidateNodeAccess();
+
+    // everything else is locked by TLParamsLocked while acquiring
+    const bool restart = _isAcquiring && !isLiveWriteable(propId);
+    if (restart)
         stopAcquisition();
 
+    bool success;
+    try {
+        success = setNodeProperty(propId, value);
+    } catch (...) {
+        // CV_Error or the peak library, the capture is not left stopped
+        if (restart && !_isAcquiring)
+            startAcquisition();
+        throw;
+    }
+
+    if (restart && !_isAcquiring)
+        startAcquisition();
+
+    return success;
+}
+
+/**
+ *  Whether propId can be written without stopping acquisition, i.e. its
+ *  node is not locked by TLParamsLocked and currently writeable.
+ */
+bool
+PeakVideoCapture::isLiveWriteable(int propId) const
+{
+    switch (propId) {
+        case cv::CAP_PROP_AUTO_EXPOSURE:
+            return _nodes.exposureAuto && isWriteable(_nodes.exposureAuto);
+        case cv::CAP_PROP_EXPOSURE:
+            return _nodes.exposureTime && isWriteable(_nodes.exposureTime);
+        case cv::CAP_PROP_GAIN:
+            return _nodes.gain && isWriteable(_nodes.gain);
+        case cv::CAP_PROP_FPS:
+            if (_nodes.acquisitionFrameRateTargetEnable &&
+                _nodes.acquisitionFrameRateTarget)
+                return isWriteable(_nodes.acquisitionFrameRateTargetEnable);
+
+            return _nodes.acquisitionFrameRate &&
+                   isWriteable(_nodes.acquisitionFrameRate);
+        default:
+            return false;
+    }
+}
+
+bool
+PeakVideoCapture::setNodeProperty(int propId, double value)
+{
     try {
 
         switch (propId) {
 
             case cv::CAP_PROP_AUTO_EXPOSURE: {
-                auto node =
-                  _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                    "ExposureAuto");
+                const auto& node = require(_nodes.exposureAuto, _nodeMap);
 
                 if (!isWriteable(node)) {
                     if (throwOnFail)
@@ -351,8 +1407,7 @@ PeakVideoCapture::set(int propId, double value)
             } break;
 
             case cv::CAP_PROP_EXPOSURE: {
-                auto node = _nodeMap->FindNode<peak::core::nodes::FloatNode>(
-                  "ExposureTime");
+                const auto& node = require(_nodes.exposureTime, _nodeMap);
 
                 if (value < node->Minimum() || node->Maximum() < value) {
                     if (throwOnFail)
@@ -373,19 +1428,35 @@ PeakVideoCapture::set(int propId, double value)
 
             } break;
 
-            case cv::CAP_PROP_FPS: {
+            case cv::CAP_PROP_GAIN: {
+                const auto& node = require(_nodes.gain, _nodeMap);
+
+                if (value < node->Minimum() || node->Maximum() < value) {
+                    if (throwOnFail)
+                        CV_Error(Error::StsBadArg, "Argument out of range");
+
+                    return false;
+                }
+
+                if (!isWriteable(node)) {
+                    if (throwOnFail)
+                        CV_Error(Error::StsError, "Gain is not writeable");
+
+                    return false;
+                }
+
+                nodeCheckedSetValue(node, value);
+
+            } break;
 
-                bool hasTargetEnable =
-                       _nodeMap->HasNode("AcquisitionFrameRateTargetEanble"),
-                     hasTarget =
-                       _nodeMap->HasNode("AcquisitionFrameRateTarget"),
-                     hasRate = _nodeMap->HasNode("AcquisitionFrameRate");
+            case cv::CAP_PROP_FPS: {
 
-                if (hasTargetEnable && hasTarget) {
+                const auto& targetEnableNode =
+                  _nodes.acquisitionFrameRateTargetEnable;
+                const auto& targetNode = _nodes.acquisitionFrameRateTarget;
+                const auto& rateNode = _nodes.acquisitionFrameRate;
 
-                    auto targetEnableNode =
-                      _nodeMap->FindNode<peak::core::nodes::BooleanNode>(
-                        "AcquisitionFrameRateTargetEnable");
+                if (targetEnableNode && targetNode) {
 
                     if (!isReadable(targetEnableNode)) {
                         if (throwOnFail)
@@ -405,12 +1476,10 @@ PeakVideoCapture::set(int propId, double value)
                         return false;
                     }
 
-                    if (targetEnableNode->Value())
+                    if (targetEnableNode->Value()) {
                         targetEnableNode->SetValue(false);
-
-                    auto targetNode =
-                      _nodeMap->FindNode<peak::core::nodes::FloatNode>(
-                        "AcquisitionFrameRateTarget");
+                        invalidateNodeAccess();
+                    }
 
                     if (!isWriteable(targetNode)) {
                         if (throwOnFail)
@@ -425,11 +1494,7 @@ PeakVideoCapture::set(int propId, double value)
 
                     targetEnableNode->SetValue(true);
 
-                } else if (hasRate) {
-
-                    auto rateNode =
-                      _nodeMap->FindNode<peak::core::nodes::FloatNode>(
-                        "AcquisitionFrameRate");
+                } else if (rateNode) {
 
                     if (!isWriteable(rateNode)) {
                         if (throwOnFail)
@@ -451,9 +1516,8 @@ PeakVideoCapture::set(int propId, double value)
             } break;
 
             case cv::CAP_PROP_TRIGGER: {
-                auto triggerModeNode =
-                  _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                    "TriggerMode");
+                const auto& triggerModeNode =
+                  require(_nodes.triggerMode, _nodeMap);
 
                 if (!isWriteable(triggerModeNode)) {
                     if (throwOnFail)
@@ -465,11 +1529,11 @@ PeakVideoCapture::set(int propId, double value)
 
                 if (0.0 == value) {
                     triggerModeNode->SetCurrentEntry("Off");
+                    invalidateNodeAccess();
                     return true;
                 } else {
-                    auto triggerSourceNode =
-                      _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                        "TriggerSource");
+                    const auto& triggerSourceNode =
+                      require(_nodes.triggerSource, _nodeMap);
 
                     if (!isWriteable(triggerSourceNode)) {
                         if (throwOnFail)
@@ -481,10 +1545,10 @@ PeakVideoCapture::set(int propId, double value)
 
                     triggerModeNode->SetCurrentEntry("On");
                     triggerSourceNode->SetCurrentEntry("Line0");
+                    invalidateNodeAccess();
 
-                    auto triggerActivationNode =
-                      _nodeMap->FindNode<peak::core::nodes::EnumerationNode>(
-                        "TriggerActivation");
+                    const auto& triggerActivationNode =
+                      require(_nodes.triggerActivation, _nodeMap);
 
                     if (!isWriteable(triggerActivationNode)) {
                         if (throwOnFail)
@@ -501,10 +1565,43 @@ PeakVideoCapture::set(int propId, double value)
 
             } break;
 
+            case cv::CAP_PROP_FRAME_WIDTH:
+            case cv::CAP_PROP_FRAME_HEIGHT:
+            case CAP_PROP_PEAK_OFFSET_X:
+            case CAP_PROP_PEAK_OFFSET_Y:
+            case CAP_PROP_PEAK_BINNING_HORIZONTAL:
+            case CAP_PROP_PEAK_BINNING_VERTICAL:
+            case CAP_PROP_PEAK_DECIMATION_HORIZONTAL:
+            case CAP_PROP_PEAK_DECIMATION_VERTICAL: {
+                const auto& node = require(*imageFormatNode(propId), _nodeMap);
+
+                if (value < 0.0) {
+                    if (throwOnFail)
+                        CV_Error(Error::StsBadArg, "Argument out of range");
+
+                    return false;
+                }
+
+                if (!isWriteable(node)) {
+                    if (throwOnFail)
+                        CV_Error(Error::StsError,
+                                 fmt::format("{} is not writeable",
+                                             node.name()));
+
+                    return false;
+                }
+
+                nodeCheckedSetValue(node, static_cast<int64_t>(value));
+                invalidateNodeAccess();
+
+                return reannounceBuffersIfNeeded();
+            }
+
             default:
                 return false;
         }
 
+        invalidateNodeAccess();
         return true;
 
     } catch (const peak::core::NotFoundException& nfe) {
@@ -521,10 +1618,13 @@ PeakVideoCapture::startAcquisition()
     _dataStream->StartAcquisition(peak::core::AcquisitionStartMode::Default,
                                   PEAK_INFINITE_NUMBER);
 
-    _nodeMap->FindNode<peak::core::nodes::IntegerNode>("TLParamsLocked")
-      ->SetValue(1);
-    _nodeMap->FindNode<peak::core::nodes::CommandNode>("AcquisitionStart")
-      ->Execute();
+    require(_nodes.tlParamsLocked, _nodeMap)->SetValue(1);
+    require(_nodes.acquisitionStart, _nodeMap)->Execute();
+    invalidateNodeAccess();
+
+    if (_acquisitionMode != PEAK_ACQUISITION_INLINE)
+        _acquisitionThread =
+          std::make_unique<AcquisitionThread>(_dataStream, _acquisitionMode);
 
     _isAcquiring = true;
 }
@@ -532,11 +1632,15 @@ PeakVideoCapture::startAcquisition()
 void
 PeakVideoCapture::stopAcquisition()
 {
+    if (_acquisitionThread) {
+        _framesDropped += _acquisitionThread->dropped();
+        _acquisitionThread = nullptr;
+    }
+
     if (_nodeMap) {
-        _nodeMap->FindNode<peak::core::nodes::CommandNode>("AcquisitionStop")
-          ->Execute();
-        _nodeMap->FindNode<peak::core::nodes::IntegerNode>("TLParamsLocked")
-          ->SetValue(0);
+        require(_nodes.acquisitionStop, _nodeMap)->Execute();
+        require(_nodes.tlParamsLocked, _nodeMap)->SetValue(0);
+        invalidateNodeAccess();
     }
 
     if (_dataStream)
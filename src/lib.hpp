@@ -1,28 +1,332 @@
 #pragma once
 
+#include <functional>
+#include <optional>
+
 #include <opencv2/videoio.hpp>
 #include <peak/peak.hpp>
 
 namespace cv {
 
-class PeakVideoCapture : public VideoCapture
+/**
+ *  Properties specific to PeakVideoCapture, see PeakVideoCapture::get() and
+ *  PeakVideoCapture::set().
+ */
+enum PeakVideoCaptureProperties
+{
+    CAP_PROP_PEAK_ZERO_COPY = 0x10000,
+    CAP_PROP_PEAK_LEASE_BLOCKING,
+    CAP_PROP_PEAK_LEASES_ACTIVE,
+    CAP_PROP_PEAK_LEASES_PEAK,
+    CAP_PROP_PEAK_LEASES_TOTAL,
+    CAP_PROP_PEAK_LEASES_REFUSED,
+    CAP_PROP_PEAK_BUFFER_ALLOCATION,
+    CAP_PROP_PEAK_BUFFERS_ANNOUNCED,
+    CAP_PROP_PEAK_BUFFERS_QUEUED,
+    CAP_PROP_PEAK_BUFFERS_AWAIT_DELIVERY,
+    CAP_PROP_PEAK_BUFFER_UNDERRUNS,
+    CAP_PROP_PEAK_ACQUISITION_MODE,
+    CAP_PROP_PEAK_FRAMES_DROPPED,
+    CAP_PROP_PEAK_DEBAYER_MODE,
+    CAP_PROP_PEAK_PIXEL_FORMAT,
+    CAP_PROP_PEAK_CONVERT_8BIT,
+    CAP_PROP_PEAK_OFFSET_X,
+    CAP_PROP_PEAK_OFFSET_Y,
+    CAP_PROP_PEAK_BINNING_HORIZONTAL,
+    CAP_PROP_PEAK_BINNING_VERTICAL,
+    CAP_PROP_PEAK_DECIMATION_HORIZONTAL,
+    CAP_PROP_PEAK_DECIMATION_VERTICAL,
+    CAP_PROP_PEAK_FRAME_ID,
+    CAP_PROP_PEAK_CHUNKS,
+    CAP_PROP_PEAK_CHUNK_EXPOSURE,
+    CAP_PROP_PEAK_CHUNK_GAIN,
+    CAP_PROP_PEAK_FRAMES_DELIVERED,
+    CAP_PROP_PEAK_FRAMES_LOST,
+    CAP_PROP_PEAK_FRAMES_INCOMPLETE,
+    CAP_PROP_PEAK_PAYLOAD_SIZE,
+};
+
+/**
+ *  Camera pixel formats understood by PeakVideoCapture, see
+ *  CAP_PROP_PEAK_PIXEL_FORMAT. The g40/g24 formats are the IDS-specific
+ *  Mono10g40IDS, Mono12g24IDS, BayerRG10g40IDS and BayerRG12g24IDS.
+ */
+enum PeakPixelFormat
+{
+    PEAK_PIXEL_FORMAT_UNKNOWN = 0,
+    PEAK_PIXEL_FORMAT_MONO8,
+    PEAK_PIXEL_FORMAT_BAYERRG8,
+    PEAK_PIXEL_FORMAT_MONO10,
+    PEAK_PIXEL_FORMAT_MONO12,
+    PEAK_PIXEL_FORMAT_MONO10P,
+    PEAK_PIXEL_FORMAT_MONO12P,
+    PEAK_PIXEL_FORMAT_MONO10G40,
+    PEAK_PIXEL_FORMAT_MONO12G24,
+    PEAK_PIXEL_FORMAT_BAYERRG10,
+    PEAK_PIXEL_FORMAT_BAYERRG12,
+    PEAK_PIXEL_FORMAT_BAYERRG10P,
+    PEAK_PIXEL_FORMAT_BAYERRG12P,
+    PEAK_PIXEL_FORMAT_BAYERRG10G40,
+    PEAK_PIXEL_FORMAT_BAYERRG12G24,
+};
+
+/**
+ *  Values for CAP_PROP_PEAK_DEBAYER_MODE.
+ */
+enum PeakDebayerMode
+{
+    // Bayer images are returned as single-channel mosaic
+    PEAK_DEBAYER_NONE = 0,
+    // full-resolution BGR through cv::cvtColor
+    PEAK_DEBAYER_FULL,
+    // half-width, half-height BGR, one pixel per 2x2 quad
+    PEAK_DEBAYER_HALF,
+};
+
+/**
+ *  Values for CAP_PROP_PEAK_BUFFER_ALLOCATION.
+ */
+enum PeakBufferAllocation
+{
+    // buffers are allocated by the peak SDK
+    PEAK_BUFFER_ALLOC_SDK = 0,
+    // anonymous page-aligned mappings
+    PEAK_BUFFER_ALLOC_PAGE_ALIGNED,
+    // MAP_HUGETLB, falling back to transparent hugepages
+    PEAK_BUFFER_ALLOC_HUGEPAGES,
+    // page-aligned, prefaulted and mlock'd
+    PEAK_BUFFER_ALLOC_LOCKED,
+};
+
+struct BufferLeaseStatistics
+{
+    // buffers currently held by cv::Mat instances
+    size_t active = 0;
+    // highest number of simultaneously held buffers
+    size_t peak = 0;
+    // buffers leased since open()
+    size_t total = 0;
+    // grabs that were refused or timed out because every buffer was leased
+    size_t refused = 0;
+};
+
+/**
+ *  Values for CAP_PROP_PEAK_ACQUISITION_MODE.
+ */
+enum PeakAcquisitionMode
+{
+    // grab() waits for the next finished buffer itself
+    PEAK_ACQUISITION_INLINE = 0,
+    // a background thread keeps only the newest frame, stale frames are
+    // requeued immediately
+    PEAK_ACQUISITION_LATEST,
+    // a background thread queues every frame, bounded by the buffer pool
+    PEAK_ACQUISITION_LOSSLESS,
+};
+
+struct BufferPoolOccupancy
+{
+    // buffers announced to the data stream
+    size_t announced = 0;
+    // buffers waiting to be filled by the camera
+    size_t queued = 0;
+    // filled buffers waiting to be picked up by grab()
+    size_t awaitDelivery = 0;
+    // buffers held by cv::Mat instances in zero-copy mode
+    size_t leased = 0;
+    // frames that arrived while no buffer was queued
+    size_t underruns = 0;
+};
+
+/**
+ *  Per-frame information of the last grabbed buffer.
+ */
+struct FrameMetadata
+{
+    // frame counter of the device
+    uint64_t frameId = 0;
+    // device timestamp in ns
+    uint64_t timestampNs = 0;
+    // the buffer was delivered although it was not completely filled
+    bool incomplete = false;
+    // exposure time in µs and gain at capture, if the frame carried chunk
+    // data for them
+    std::optional<double> exposureTime, gain;
+};
+
+struct FrameCounters
+{
+    // frames delivered by the data stream since open()
+    size_t delivered = 0;
+    // frames the data stream lost, e.g. to transport errors
+    size_t lost = 0;
+    // frames delivered although not completely filled
+    size_t incomplete = 0;
+    // frames that arrived while no buffer was queued
+    size_t underruns = 0;
+    // stale frames dropped in PEAK_ACQUISITION_LATEST mode
+    size_t dropped = 0;
+};
+
+/**
+ *  Undecoded data of a grabbed frame, as delivered by the camera.
+ */
+struct RawFrame
+{
+    const void* data = nullptr;
+    // bytes of pixel data, without any trailing chunk data
+    size_t size = 0;
+    int width = 0, height = 0;
+    PeakPixelFormat pixelFormat = PEAK_PIXEL_FORMAT_UNKNOWN;
+};
+
+/**
+ *  Frame level access shared by PeakVideoCapture and the simulated sources,
+ *  for callers that only hold a cv::VideoCapture.
+ */
+class RawFrameSource
+{
+  public:
+    virtual ~RawFrameSource() = default;
+
+    /**
+     *  Raw data of the last grabbed frame, valid until the next grab() or
+     *  retrieve(). Returns false if no frame is grabbed.
+     */
+    virtual bool rawFrame(RawFrame& frame) const = 0;
+
+    /**
+     *  Metadata of the last grabbed frame.
+     */
+    virtual const FrameMetadata& frameMetadata() const = 0;
+
+    virtual FrameCounters frameCounters() const = 0;
+};
+
+/**
+ *  GenICam node handle resolved once per open(), together with its cached
+ *  access status. The status has to be invalidated whenever a node write may
+ *  have changed it.
+ */
+template<typename TNode>
+class CachedNode
+{
+  private:
+    std::shared_ptr<TNode> _node;
+    std::string _name;
+    mutable std::optional<peak::core::nodes::NodeAccessStatus> _status;
+
+  public:
+    void resolve(const std::shared_ptr<peak::core::NodeMap>& nodeMap,
+                 const std::string& name)
+    {
+        _name = name;
+        _node = nodeMap->HasNode(name) ? nodeMap->FindNode<TNode>(name)
+                                       : nullptr;
+        _status.reset();
+    }
+
+    void reset()
+    {
+        _node = nullptr;
+        _status.reset();
+    }
+
+    void invalidate() const { _status.reset(); }
+
+    peak::core::nodes::NodeAccessStatus accessStatus() const
+    {
+        if (!_status)
+            _status = _node->AccessStatus();
+
+        return *_status;
+    }
+
+    const std::string& name() const { return _name; }
+
+    explicit operator bool() const { return nullptr != _node; }
+
+    TNode* operator->() const { return _node.get(); }
+};
+
+class BufferLeasePool;
+class AcquisitionThread;
+
+class PeakVideoCapture
+  : public VideoCapture
+  , public RawFrameSource
 {
   private:
     static std::atomic_size_t _instanceCount;
 
-    bool _debayer, _isAcquiring = false;
+    bool _isAcquiring = false;
+    PeakDebayerMode _debayerMode;
+    bool _convert8Bit = false;
+    bool _zeroCopy = false, _leaseBlocking = true;
     uint64_t _bufferTimeout;
-    enum PixelFormat
-    {
-        UNKNOWN,
-        Mono8,
-        BayerRG8,
-    } _pixelFormat = UNKNOWN;
+    size_t _numBuffers = 0;
+    // PayloadSize the announced buffers were allocated for
+    size_t _payloadSize = 0;
+    PeakBufferAllocation _bufferAllocation = PEAK_BUFFER_ALLOC_SDK;
+    PeakAcquisitionMode _acquisitionMode = PEAK_ACQUISITION_INLINE;
+    size_t _framesDropped = 0;
+    PeakPixelFormat _pixelFormat = PEAK_PIXEL_FORMAT_UNKNOWN;
+    bool _chunks = false;
+    FrameMetadata _frameMetadata;
 
     std::shared_ptr<peak::core::Device> _device;
     std::shared_ptr<peak::core::DataStream> _dataStream;
     std::shared_ptr<peak::core::NodeMap> _nodeMap;
     std::shared_ptr<peak::core::Buffer> _filledBuffer;
+    // unpacked samples of packed Bayer formats, before debayering
+    Mat _unpacked;
+    std::shared_ptr<BufferLeasePool> _leasePool;
+    std::unique_ptr<AcquisitionThread> _acquisitionThread;
+
+    struct
+    {
+        CachedNode<peak::core::nodes::EnumerationNode> exposureAuto;
+        CachedNode<peak::core::nodes::FloatNode> exposureTime;
+        CachedNode<peak::core::nodes::FloatNode> gain;
+        CachedNode<peak::core::nodes::FloatNode> acquisitionFrameRate;
+        CachedNode<peak::core::nodes::FloatNode> acquisitionFrameRateTarget;
+        CachedNode<peak::core::nodes::BooleanNode>
+          acquisitionFrameRateTargetEnable;
+        CachedNode<peak::core::nodes::EnumerationNode> triggerMode;
+        CachedNode<peak::core::nodes::EnumerationNode> triggerSource;
+        CachedNode<peak::core::nodes::EnumerationNode> triggerActivation;
+        CachedNode<peak::core::nodes::IntegerNode> width;
+        CachedNode<peak::core::nodes::IntegerNode> height;
+        CachedNode<peak::core::nodes::IntegerNode> offsetX;
+        CachedNode<peak::core::nodes::IntegerNode> offsetY;
+        CachedNode<peak::core::nodes::IntegerNode> binningHorizontal;
+        CachedNode<peak::core::nodes::IntegerNode> binningVertical;
+        CachedNode<peak::core::nodes::IntegerNode> decimationHorizontal;
+        CachedNode<peak::core::nodes::IntegerNode> decimationVertical;
+        CachedNode<peak::core::nodes::IntegerNode> payloadSize;
+        CachedNode<peak::core::nodes::IntegerNode> tlParamsLocked;
+        CachedNode<peak::core::nodes::CommandNode> acquisitionStart;
+        CachedNode<peak::core::nodes::CommandNode> acquisitionStop;
+        CachedNode<peak::core::nodes::FloatNode> chunkExposureTime;
+        CachedNode<peak::core::nodes::FloatNode> chunkGain;
+    } _nodes;
+
+    void resolveNodes();
+    void resetNodes();
+    void invalidateNodeAccess() const;
+    const CachedNode<peak::core::nodes::IntegerNode>* imageFormatNode(
+      int propId) const;
+
+    bool announceBuffers();
+    void revokeBuffers();
+    bool reannounceBuffersIfNeeded();
+    bool replaceBuffers(bool restart, const std::function<void()>& restore);
+
+    void setChunkMode(bool enable);
+    void updateFrameMetadata();
+
+    bool isLiveWriteable(int propId) const;
+    bool setNodeProperty(int propId, double value);
 
   public:
     PeakVideoCapture(
@@ -38,6 +342,12 @@ class PeakVideoCapture : public VideoCapture
     // Second parameter unused
     virtual bool open(int index, int = 0) override;
 
+    /**
+     *  Index for open() of the connected camera with the given serial
+     *  number, -1 if there is none.
+     */
+    int cameraIndex(const std::string& serialNumber) const;
+
     virtual void release() override;
 
     virtual bool isOpened() const override;
@@ -47,11 +357,34 @@ class PeakVideoCapture : public VideoCapture
     void startAcquisition();
     void stopAcquisition();
 
-    // Second parameter unused
+    /**
+     *  If zero-copy mode is enabled (see CAP_PROP_PEAK_ZERO_COPY) and no
+     *  conversion is necessary, the returned image references the peak
+     *  buffer directly. The buffer is handed back to the data stream once the
+     *  last cv::Mat referencing it is released, so do not hold on to more
+     *  images than there are buffers.
+     *
+     *  Second parameter unused
+     */
     virtual bool retrieve(OutputArray image, int = 0) override;
 
+    /**
+     *  Like retrieve(), additionally returning the metadata of the frame.
+     */
+    bool retrieve(OutputArray image, FrameMetadata& metadata);
+
     virtual bool read(OutputArray image) override;
 
+    BufferLeaseStatistics leaseStatistics() const;
+
+    BufferPoolOccupancy bufferPoolOccupancy() const;
+
+    virtual bool rawFrame(RawFrame& frame) const override;
+
+    virtual const FrameMetadata& frameMetadata() const override;
+
+    virtual FrameCounters frameCounters() const override;
+
     /**
      *  Implemented properties:
      *
@@ -59,10 +392,62 @@ class PeakVideoCapture : public VideoCapture
      *      Zero if autoexposure in camera driver is disabled, else non-zero.
      *  - cv::CAP_PROP_EXPOSURE:
      *      Gets current exposuretime in µs.
+     *  - cv::CAP_PROP_GAIN:
+     *      Gets current gain.
      *  - cv::CAP_PROP_FPS:
      *      Gets current framerate.
      *  - cv::CAP_PROP_TRIGGER:
      *      Zero if trigger-mode is disabled, else non-zero.
+     *  - cv::CAP_PROP_PEAK_ZERO_COPY:
+     *      Non-zero if zero-copy mode is enabled.
+     *  - cv::CAP_PROP_PEAK_LEASE_BLOCKING:
+     *      Non-zero if grab() blocks while every buffer is leased.
+     *  - cv::CAP_PROP_PEAK_LEASES_ACTIVE, cv::CAP_PROP_PEAK_LEASES_PEAK,
+     *    cv::CAP_PROP_PEAK_LEASES_TOTAL, cv::CAP_PROP_PEAK_LEASES_REFUSED:
+     *      See BufferLeaseStatistics.
+     *  - cv::CAP_PROP_BUFFERSIZE:
+     *      Configured number of buffers, zero meaning the minimum required.
+     *  - cv::CAP_PROP_PEAK_BUFFER_ALLOCATION:
+     *      Configured PeakBufferAllocation.
+     *  - cv::CAP_PROP_PEAK_BUFFERS_ANNOUNCED, cv::CAP_PROP_PEAK_BUFFERS_QUEUED,
+     *    cv::CAP_PROP_PEAK_BUFFERS_AWAIT_DELIVERY,
+     *    cv::CAP_PROP_PEAK_BUFFER_UNDERRUNS:
+     *      See BufferPoolOccupancy.
+     *  - cv::CAP_PROP_PEAK_ACQUISITION_MODE:
+     *      Configured PeakAcquisitionMode.
+     *  - cv::CAP_PROP_PEAK_FRAMES_DROPPED:
+     *      Number of stale frames dropped in PEAK_ACQUISITION_LATEST mode.
+     *  - cv::CAP_PROP_PEAK_DEBAYER_MODE:
+     *      Configured PeakDebayerMode.
+     *  - cv::CAP_PROP_PEAK_PIXEL_FORMAT:
+     *      PeakPixelFormat of the opened camera.
+     *  - cv::CAP_PROP_PEAK_CONVERT_8BIT:
+     *      Non-zero if 10 and 12-bit formats are converted to 8 bit.
+     *  - cv::CAP_PROP_FRAME_WIDTH, cv::CAP_PROP_FRAME_HEIGHT:
+     *      Size of the sensor region of interest in pixels, after binning
+     *      and decimation.
+     *  - cv::CAP_PROP_PEAK_OFFSET_X, cv::CAP_PROP_PEAK_OFFSET_Y:
+     *      Offset of the region of interest.
+     *  - cv::CAP_PROP_PEAK_BINNING_HORIZONTAL,
+     *    cv::CAP_PROP_PEAK_BINNING_VERTICAL,
+     *    cv::CAP_PROP_PEAK_DECIMATION_HORIZONTAL,
+     *    cv::CAP_PROP_PEAK_DECIMATION_VERTICAL:
+     *      Current binning and decimation factors.
+     *  - cv::CAP_PROP_POS_MSEC:
+     *      Device timestamp of the last grabbed frame in ms.
+     *  - cv::CAP_PROP_PEAK_FRAME_ID:
+     *      Device frame counter of the last grabbed frame.
+     *  - cv::CAP_PROP_PEAK_CHUNKS:
+     *      Non-zero if chunk data is requested from the device.
+     *  - cv::CAP_PROP_PEAK_CHUNK_EXPOSURE, cv::CAP_PROP_PEAK_CHUNK_GAIN:
+     *      Exposure time in µs and gain of the last grabbed frame, taken from
+     *      its chunk data. Zero if the frame did not carry them.
+     *  - cv::CAP_PROP_PEAK_FRAMES_DELIVERED, cv::CAP_PROP_PEAK_FRAMES_LOST,
+     *    cv::CAP_PROP_PEAK_FRAMES_INCOMPLETE:
+     *      See FrameCounters.
+     *  - cv::CAP_PROP_PEAK_PAYLOAD_SIZE:
+     *      Size of the announced buffers in bytes, the PayloadSize of the
+     *      device including any chunk data.
      */
     virtual double get(int propId) const override;
 
@@ -74,12 +459,62 @@ class PeakVideoCapture : public VideoCapture
      *  - cv::CAP_PROP_EXPOSURE:
      *      Sets exposuretime to a value in µs.
      *      Autoexposure needs to be disabled for this to work correctly.
+     *  - cv::CAP_PROP_GAIN:
+     *      Sets gain of the default gain selector.
      *  - cv::CAP_PROP_FPS:
      *      Sets FPS target.
      *      This may not necessarily be reached, based on camera capabilities
      *      and exposure time.
      *  - cv::CAP_PROP_TRIGGER:
      *      Enables or disables trigger on Line0.
+     *  - cv::CAP_PROP_PEAK_ZERO_COPY:
+     *      Enables or disables zero-copy mode, see retrieve().
+     *  - cv::CAP_PROP_PEAK_LEASE_BLOCKING:
+     *      If enabled (default), grab() waits up to the buffer timeout for a
+     *      leased buffer to be released when every buffer is leased out.
+     *      Otherwise grab() fails immediately in that case.
+     *  - cv::CAP_PROP_BUFFERSIZE:
+     *      Sets the number of buffers announced to the data stream. Values
+     *      below the minimum required by the device are raised to it, zero
+     *      selects the minimum.
+     *  - cv::CAP_PROP_PEAK_BUFFER_ALLOCATION:
+     *      Sets how buffer memory is allocated, see PeakBufferAllocation.
+     *  - cv::CAP_PROP_PEAK_ACQUISITION_MODE:
+     *      Sets whether grab() waits for buffers itself or takes them from a
+     *      background acquisition thread, see PeakAcquisitionMode.
+     *  - cv::CAP_PROP_PEAK_DEBAYER_MODE:
+     *      Sets how Bayer images are converted, see PeakDebayerMode. The
+     *      debayer constructor argument selects PEAK_DEBAYER_FULL.
+     *  - cv::CAP_PROP_PEAK_CONVERT_8BIT:
+     *      If enabled, 10 and 12-bit formats are returned as CV_8U holding
+     *      the most significant bits of each sample. Otherwise (default) they
+     *      are returned as CV_16U holding the LSB-aligned samples.
+     *  - cv::CAP_PROP_FRAME_WIDTH, cv::CAP_PROP_FRAME_HEIGHT,
+     *    cv::CAP_PROP_PEAK_OFFSET_X, cv::CAP_PROP_PEAK_OFFSET_Y:
+     *      Sets the sensor region of interest. Values are rounded down to the
+     *      increment and clamped to the range the device currently allows, so
+     *      shrink the region before moving it towards the sensor edge, and
+     *      move it back before growing it.
+     *  - cv::CAP_PROP_PEAK_BINNING_HORIZONTAL,
+     *    cv::CAP_PROP_PEAK_BINNING_VERTICAL,
+     *    cv::CAP_PROP_PEAK_DECIMATION_HORIZONTAL,
+     *    cv::CAP_PROP_PEAK_DECIMATION_VERTICAL:
+     *      Sets binning and decimation factors. These change the range of the
+     *      region of interest, so set them first.
+     *  - cv::CAP_PROP_PEAK_CHUNKS:
+     *      If enabled, exposure time and gain are requested as chunk data
+     *      with every frame, see FrameMetadata. This enlarges the PayloadSize.
+     *      Disabled by default, which leaves the chunk nodes untouched, as do
+     *      devices without chunk support.
+     *
+     *  The buffer properties may be set before open(). When set on an open
+     *  capture, the buffers are reallocated. The same happens whenever a
+     *  property changes the PayloadSize of the device.
+     *
+     *  cv::CAP_PROP_AUTO_EXPOSURE, cv::CAP_PROP_EXPOSURE, cv::CAP_PROP_GAIN
+     *  and cv::CAP_PROP_FPS are applied while acquiring as long as the device
+     *  allows writing them. Other properties stop acquisition for the write
+     *  and restart it afterwards, losing the frames in between.
      */
     virtual bool set(int propId, double value) override;
 };
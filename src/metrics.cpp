@@ -0,0 +1,121 @@
+#include "metrics.hpp"
+
+#include <iterator>
+
+#include <fmt/core.h>
+
+using namespace XVII;
+
+// clang-format off
+
+struct HistogramInfo
+{
+    const char* name;
+    const char* help;
+    // upper bound of the first bucket
+    uint64_t first;
+    // from the recorded unit to the rendered one
+    double scale;
+};
+
+static const HistogramInfo HISTOGRAMS[] = {
+    { "peakcvbridge_grab_wait_seconds",  "Time spent in grab().",                16,   1e-6 },
+    { "peakcvbridge_retrieve_seconds",   "Time spent in retrieve().",            16,   1e-6 },
+    { "peakcvbridge_encode_seconds",     "Time spent encoding one payload.",     16,   1e-6 },
+    { "peakcvbridge_send_seconds",       "Time until a queued frame was sent.",  16,   1e-6 },
+    { "peakcvbridge_encoded_bytes",      "Size of one encoded payload.",         1024, 1.0  },
+};
+
+// clang-format on
+
+static_assert(std::size(HISTOGRAMS) == size_t(Histogram::COUNT));
+
+std::atomic<uint64_t> Metrics::_nextId(1);
+
+static void
+add(std::atomic<uint64_t>& counter, uint64_t value)
+{
+    // only ever written by one thread, no read-modify-write needed
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+}
+
+Metrics::Metrics()
+  : _id(_nextId++)
+{
+}
+
+Metrics::Shard&
+Metrics::localShard()
+{
+    // one shard per thread and Metrics, only the first use takes the lock
+    thread_local uint64_t owner = 0;
+    thread_local Shard* shard = nullptr;
+
+    if (owner != _id) {
+        std::lock_guard lock(_shardsMutex);
+        shard = _shards.emplace_back(std::make_unique<Shard>()).get();
+        owner = _id;
+    }
+
+    return *shard;
+}
+
+void
+Metrics::observe(Histogram histogram, uint64_t value)
+{
+    const auto index = size_t(histogram);
+    auto& shard = localShard();
+
+    size_t bucket = 0;
+    for (uint64_t bound = HISTOGRAMS[index].first;
+         bucket < BUCKETS && value > bound;
+         bound <<= 1)
+        bucket++;
+
+    add(shard.buckets[index][bucket], 1);
+    add(shard.sums[index], value);
+}
+
+std::string
+Metrics::render() const
+{
+    std::string out;
+    auto it = std::back_inserter(out);
+
+    std::lock_guard lock(_shardsMutex);
+
+    for (size_t index = 0; index < size_t(Histogram::COUNT); index++) {
+        const auto& info = HISTOGRAMS[index];
+
+        std::array<uint64_t, BUCKETS + 1> buckets{};
+        uint64_t sum = 0;
+        for (const auto& shard : _shards) {
+            for (size_t bucket = 0; bucket <= BUCKETS; bucket++)
+                buckets[bucket] +=
+                  shard->buckets[index][bucket].load(std::memory_order_relaxed);
+            sum += shard->sums[index].load(std::memory_order_relaxed);
+        }
+
+        fmt::format_to(it, "# HELP {} {}\n", info.name, info.help);
+        fmt::format_to(it, "# TYPE {} histogram\n", info.name);
+
+        // cumulative, as Prometheus expects
+        uint64_t count = 0, bound = info.first;
+        for (size_t bucket = 0; bucket < BUCKETS; bucket++, bound <<= 1) {
+            count += buckets[bucket];
+            fmt::format_to(it,
+                           "{}_bucket{{le=\"{}\"}} {}\n",
+                           info.name,
+                           bound * info.scale,
+                           count);
+        }
+        count += buckets[BUCKETS];
+
+        fmt::format_to(it, "{}_bucket{{le=\"+Inf\"}} {}\n", info.name, count);
+        fmt::format_to(it, "{}_sum {}\n", info.name, sum * info.scale);
+        fmt::format_to(it, "{}_count {}\n", info.name, count);
+    }
+
+    return out;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace XVII {
+
+enum class Histogram
+{
+    // time spent in grab(), retrieve() and encoding one payload
+    GRAB_WAIT,
+    RETRIEVE,
+    ENCODE,
+    // from handing a frame to a connection until it was sent
+    SEND,
+    // size of one encoded payload
+    ENCODED_BYTES,
+    COUNT,
+};
+
+/**
+ *  Histograms of the streamer's stages, rendered in the Prometheus text
+ *  format. Each thread records into a shard of its own, which only it
+ *  writes, with relaxed atomic loads and stores, so observe() never takes a
+ *  lock or a contended cache line. render() adds up the shards, every
+ *  value it reads was complete when written.
+ */
+class Metrics
+{
+  public:
+    // bucket upper bounds double from the first one
+    static constexpr size_t BUCKETS = 20;
+
+  private:
+    // on cache lines of its own
+    struct alignas(64) Shard
+    {
+        // the last bucket is +Inf
+        std::array<std::array<std::atomic<uint64_t>, BUCKETS + 1>,
+                   size_t(Histogram::COUNT)>
+          buckets{};
+        std::array<std::atomic<uint64_t>, size_t(Histogram::COUNT)> sums{};
+    };
+
+    static std::atomic<uint64_t> _nextId;
+    // told apart by the shards of the threads
+    uint64_t _id;
+
+    mutable std::mutex _shardsMutex;
+    std::vector<std::unique_ptr<Shard>> _shards;
+
+    Shard& localShard();
+
+  public:
+    Metrics();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    /**
+     *  Records value, in µs for latencies and in bytes for sizes.
+     */
+    void observe(Histogram histogram, uint64_t value);
+
+    void observe(Histogram histogram, std::chrono::nanoseconds duration)
+    {
+        observe(histogram,
+                static_cast<uint64_t>(duration.count() / 1000));
+    }
+
+    /**
+     *  All histograms with their HELP and TYPE lines.
+     */
+    std::string render() const;
+};
+
+}
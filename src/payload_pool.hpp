@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <server_ws.hpp>
+
+namespace XVII {
+
+/**
+ *  Reusable websocket payloads. acquire() hands out an empty message which
+ *  returns to the pool, keeping its allocation, once its last reference is
+ *  released, i.e. after the last send of it completed. At most maxFree
+ *  messages are kept, the remaining ones are freed. Has to be owned by a
+ *  std::shared_ptr.
+ */
+class PayloadPool : public std::enable_shared_from_this<PayloadPool>
+{
+  public:
+    using OutMessage = SimpleWeb::SocketServer<SimpleWeb::WS>::OutMessage;
+
+  private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<OutMessage>> _free;
+    size_t _maxFree;
+
+    void release(OutMessage* message)
+    {
+        // the streambuf of an OutMessage, consume() keeps its storage
+        auto* buffer = static_cast<asio::streambuf*>(message->rdbuf());
+        buffer->consume(buffer->size());
+        message->clear();
+
+        std::lock_guard lock(_mutex);
+        if (_free.size() < _maxFree)
+            _free.emplace_back(message);
+        else
+            delete message;
+    }
+
+  public:
+    explicit PayloadPool(size_t maxFree)
+      : _maxFree(maxFree)
+    {
+    }
+
+    std::shared_ptr<OutMessage> acquire()
+    {
+        std::unique_ptr<OutMessage> message;
+        {
+            std::lock_guard lock(_mutex);
+            if (!_free.empty()) {
+                message = std::move(_free.back());
+                _free.pop_back();
+            }
+        }
+
+        if (!message)
+            message = std::make_unique<OutMessage>();
+
+        // messages still in flight when the pool is gone are just freed
+        return std::shared_ptr<OutMessage>(
+          message.release(),
+          [pool = weak_from_this()](OutMessage* released) {
+              if (auto p = pool.lock())
+                  p->release(released);
+              else
+                  delete released;
+          });
+    }
+
+    /**
+     *  A pooled message holding a copy of the given asio buffer sequence.
+     */
+    template<typename ConstBufferSequence>
+    std::shared_ptr<OutMessage> acquire(const ConstBufferSequence& buffers)
+    {
+        auto message = acquire();
+
+        auto* buffer = static_cast<asio::streambuf*>(message->rdbuf());
+        buffer->commit(asio::buffer_copy(
+          buffer->prepare(asio::buffer_size(buffers)), buffers));
+
+        return message;
+    }
+
+    /**
+     *  A pooled message holding a copy of size bytes at data.
+     */
+    std::shared_ptr<OutMessage> acquire(const void* data, size_t size)
+    {
+        return acquire(asio::buffer(data, size));
+    }
+};
+
+}
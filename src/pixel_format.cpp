@@ -0,0 +1,110 @@
+#include "pixel_format.hpp"
+#include "debayer.hpp"
+#include "trace.hpp"
+
+#include <opencv2/imgproc.hpp>
+
+namespace cv {
+
+// clang-format off
+
+static const PixelFormatDescription PIXEL_FORMATS[] = {
+    { "Mono8",           PEAK_PIXEL_FORMAT_MONO8,         PixelPacking::None8,      false },
+    { "Mono10",          PEAK_PIXEL_FORMAT_MONO10,        PixelPacking::Unpacked10, false },
+    { "Mono12",          PEAK_PIXEL_FORMAT_MONO12,        PixelPacking::Unpacked12, false },
+    { "Mono10p",         PEAK_PIXEL_FORMAT_MONO10P,       PixelPacking::Packed10,   false },
+    { "Mono12p",         PEAK_PIXEL_FORMAT_MONO12P,       PixelPacking::Packed12,   false },
+    { "Mono10g40IDS",    PEAK_PIXEL_FORMAT_MONO10G40,     PixelPacking::Grouped10,  false },
+    { "Mono12g24IDS",    PEAK_PIXEL_FORMAT_MONO12G24,     PixelPacking::Grouped12,  false },
+    { "BayerRG8",        PEAK_PIXEL_FORMAT_BAYERRG8,      PixelPacking::None8,      true  },
+    { "BayerRG10",       PEAK_PIXEL_FORMAT_BAYERRG10,     PixelPacking::Unpacked10, true  },
+    { "BayerRG12",       PEAK_PIXEL_FORMAT_BAYERRG12,     PixelPacking::Unpacked12, true  },
+    { "BayerRG10p",      PEAK_PIXEL_FORMAT_BAYERRG10P,    PixelPacking::Packed10,   true  },
+    { "BayerRG12p",      PEAK_PIXEL_FORMAT_BAYERRG12P,    PixelPacking::Packed12,   true  },
+    { "BayerRG10g40IDS", PEAK_PIXEL_FORMAT_BAYERRG10G40,  PixelPacking::Grouped10,  true  },
+    { "BayerRG12g24IDS", PEAK_PIXEL_FORMAT_BAYERRG12G24,  PixelPacking::Grouped12,  true  },
+};
+
+// clang-format on
+
+const PixelFormatDescription*
+findPixelFormat(const std::string& name)
+{
+    for (const auto& description : PIXEL_FORMATS)
+        if (name == description.name)
+            return &description;
+
+    return nullptr;
+}
+
+const PixelFormatDescription*
+describePixelFormat(PeakPixelFormat format)
+{
+    for (const auto& description : PIXEL_FORMATS)
+        if (description.format == format)
+            return &description;
+
+    return nullptr;
+}
+
+int
+rawImageType(const PixelFormatDescription& format, bool convert8Bit)
+{
+    switch (format.packing) {
+        case PixelPacking::None8:
+            return CV_8UC1;
+        case PixelPacking::Unpacked10:
+        case PixelPacking::Unpacked12:
+            return convert8Bit ? -1 : CV_16UC1;
+        default:
+            return -1;
+    }
+}
+
+void
+convertRawFrame(const void* data,
+                int rows,
+                int cols,
+                const PixelFormatDescription& format,
+                PeakDebayerMode debayerMode,
+                bool convert8Bit,
+                Mat& scratch,
+                OutputArray image)
+{
+    const bool debayer = format.bayer && debayerMode != PEAK_DEBAYER_NONE;
+    const int type = rawImageType(format, convert8Bit);
+
+    cv::Mat raw;
+    if (type >= 0)
+        raw = cv::Mat(rows, cols, type, const_cast<void*>(data));
+    else {
+        const int unpackedType = convert8Bit ? CV_8UC1 : CV_16UC1;
+        if (debayer) {
+            scratch.create(rows, cols, unpackedType);
+            raw = scratch;
+        } else {
+            // unpack straight into the output
+            image.create(rows, cols, unpackedType);
+            raw = image.getMat();
+        }
+
+        unpackPixels(data, format.packing, raw);
+    }
+
+    if (debayer) {
+        PEAKCVBRIDGE_SPAN("debayer");
+
+        // same pattern for every BayerRG variant
+        const int code = cv::COLOR_BayerRG2BGR;
+
+        if (debayerMode == PEAK_DEBAYER_HALF) {
+            image.create(rows / 2, cols / 2, CV_MAKETYPE(raw.depth(), 3));
+            cv::Mat bgr = image.getMat();
+            debayerSuperpixel(raw, bgr, code);
+        } else
+            cv::cvtColor(raw, image, code);
+    } else if (type >= 0)
+        raw.copyTo(image);
+}
+
+}
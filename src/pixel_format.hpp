@@ -0,0 +1,47 @@
+#pragma once
+
+#include "lib.hpp"
+#include "unpack.hpp"
+
+namespace cv {
+
+struct PixelFormatDescription
+{
+    // GenICam PixelFormat entry
+    const char* name;
+    PeakPixelFormat format;
+    PixelPacking packing;
+    bool bayer;
+};
+
+const PixelFormatDescription*
+findPixelFormat(const std::string& name);
+
+const PixelFormatDescription*
+describePixelFormat(PeakPixelFormat format);
+
+/**
+ *  OpenCV type the raw samples of format can be used as in place, or -1 if
+ *  they have to be unpacked first.
+ */
+int
+rawImageType(const PixelFormatDescription& format, bool convert8Bit);
+
+/**
+ *  Converts a raw rows x cols frame to the image retrieve() returns: samples
+ *  wider than 8 bit are unpacked to CV_16U, or to CV_8U if convert8Bit is
+ *  set, and Bayer mosaics are debayered as selected by debayerMode. scratch
+ *  holds the unpacked mosaic of packed Bayer formats and is reused between
+ *  calls.
+ */
+void
+convertRawFrame(const void* data,
+                int rows,
+                int cols,
+                const PixelFormatDescription& format,
+                PeakDebayerMode debayerMode,
+                bool convert8Bit,
+                Mat& scratch,
+                OutputArray image);
+
+}
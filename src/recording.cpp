@@ -0,0 +1,331 @@
+#include "recording.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <fmt/core.h>
+
+namespace cv {
+
+static const uint8_t*
+mapFile(const std::string& path, size_t& size)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || 0 == st.st_size) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    size = static_cast<size_t>(st.st_size);
+    void* memory = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (MAP_FAILED == memory)
+        return nullptr;
+
+    // frames are read front to back
+    madvise(memory, size, MADV_SEQUENTIAL);
+
+    return static_cast<const uint8_t*>(memory);
+}
+
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+bool
+RecordingReader::open(const std::string& path)
+{
+    close();
+
+    _index = mapFile(recordingIndexPath(path), _indexSize);
+    if (nullptr == _index)
+        return false;
+
+    RecordingHeader header;
+    if (_indexSize < sizeof(header)) {
+        close();
+        return false;
+    }
+
+    std::memcpy(&header, _index, sizeof(header));
+    if (0 != std::memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) ||
+        header.version != RECORDING_VERSION ||
+        header.entrySize != sizeof(RecordingIndexEntry)) {
+        close();
+        return false;
+    }
+
+    _numFrames = (_indexSize - sizeof(header)) / sizeof(RecordingIndexEntry);
+
+    // an empty data file is a valid recording without frames
+    _data = mapFile(path, _dataSize);
+    if (nullptr == _data && 0 != _numFrames) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void
+RecordingReader::close()
+{
+    if (nullptr != _data)
+        munmap(const_cast<uint8_t*>(_data), _dataSize);
+    if (nullptr != _index)
+        munmap(const_cast<uint8_t*>(_index), _indexSize);
+
+    _data = _index = nullptr;
+    _dataSize = _indexSize = _numFrames = 0;
+}
+
+const RecordingIndexEntry&
+RecordingReader::entry(size_t frame) const
+{
+    // entries follow the 16-byte header, so they are 8-byte aligned
+    return reinterpret_cast<const RecordingIndexEntry*>(
+      _index + sizeof(RecordingHeader))[frame];
+}
+
+const uint8_t*
+RecordingReader::frameData(size_t frame) const
+{
+    const auto& e = entry(frame);
+    if (e.offset + e.size > _dataSize)
+        return nullptr;
+
+    return _data + e.offset;
+}
+
+// extents are preallocated this far ahead of the write position
+constexpr uint64_t PREALLOCATION_CHUNK = 256ull << 20;
+
+static size_t
+alignUp(size_t value)
+{
+    return (value + RECORDING_ALIGNMENT - 1) & ~(RECORDING_ALIGNMENT - 1);
+}
+
+static bool
+writeAll(int fd, const void* data, size_t size, off_t offset)
+{
+    const auto* bytes = static_cast<const uint8_t*>(data);
+
+    while (size > 0) {
+        ssize_t written = pwrite(fd, bytes, size, offset);
+        if (written < 0) {
+            if (EINTR == errno)
+                continue;
+
+            return false;
+        }
+
+        bytes += written;
+        size -= static_cast<size_t>(written);
+        offset += written;
+    }
+
+    return true;
+}
+
+RecordingWriter::~RecordingWriter()
+{
+    close();
+}
+
+bool
+RecordingWriter::open(const std::string& path,
+                      size_t maxFrameSize,
+                      size_t numBuffers)
+{
+    close();
+
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    _dataFd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    if (_dataFd < 0 && EINVAL == errno) {
+        // e.g. tmpfs
+        fmt::println(stderr, "O_DIRECT not supported for {}", path);
+        _dataFd = ::open(path.c_str(), flags, 0644);
+    }
+    if (_dataFd < 0) {
+        fmt::println(stderr, "Opening {} failed: {}", path, strerror(errno));
+        return false;
+    }
+
+    const auto indexPath = recordingIndexPath(path);
+    _indexFd = ::open(indexPath.c_str(), flags, 0644);
+
+    RecordingHeader header = {};
+    std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RECORDING_VERSION;
+    header.entrySize = sizeof(RecordingIndexEntry);
+
+    if (_indexFd < 0 || !writeAll(_indexFd, &header, sizeof(header), 0)) {
+        fmt::println(
+          stderr, "Opening {} failed: {}", indexPath, strerror(errno));
+        close();
+        return false;
+    }
+
+    _slotSize = alignUp(maxFrameSize);
+    _slots = static_cast<uint8_t*>(
+      std::aligned_alloc(RECORDING_ALIGNMENT, _slotSize * numBuffers));
+    if (nullptr == _slots) {
+        fmt::println(stderr, "Allocating staging buffers failed");
+        close();
+        return false;
+    }
+
+    _slotEntries.resize(numBuffers);
+    _free = std::make_unique<SpscRing<uint32_t>>(numBuffers);
+    _filled = std::make_unique<SpscRing<uint32_t>>(numBuffers);
+    for (uint32_t slot = 0; slot < numBuffers; slot++)
+        _free->push(slot);
+
+    _offset = _allocated = 0;
+    _framesWritten = _bytesWritten = _framesDropped = 0;
+    _stop = false;
+    _thread = std::thread(&RecordingWriter::run, this);
+
+    return true;
+}
+
+bool
+RecordingWriter::append(const void* data, const RecordingIndexEntry& entry)
+{
+    uint32_t slot;
+    if (entry.size > _slotSize || !_free->pop(slot)) {
+        _framesDropped++;
+        return false;
+    }
+
+    std::memcpy(_slots + slot * _slotSize, data, entry.size);
+    _slotEntries[slot] = entry;
+    _filled->push(slot);
+    _wake.notify_one();
+
+    return true;
+}
+
+bool
+RecordingWriter::write(uint32_t slot)
+{
+    auto& entry = _slotEntries[slot];
+    // O_DIRECT writes whole blocks, the padding keeps frames aligned
+    const size_t size = alignUp(entry.size);
+
+    if (_offset + size > _allocated) {
+        // failure (e.g. no fallocate support) just means no preallocation
+        if (0 == fallocate(_dataFd,
+                           FALLOC_FL_KEEP_SIZE,
+                           static_cast<off_t>(_allocated),
+                           static_cast<off_t>(PREALLOCATION_CHUNK)))
+            _allocated += PREALLOCATION_CHUNK;
+        else
+            _allocated = _offset + size;
+    }
+
+    if (!writeAll(_dataFd,
+                  _slots + slot * _slotSize,
+                  size,
+                  static_cast<off_t>(_offset)))
+        return false;
+
+    entry.offset = _offset;
+    if (!writeAll(_indexFd,
+                  &entry,
+                  sizeof(entry),
+                  static_cast<off_t>(sizeof(RecordingHeader) +
+                                     _framesWritten * sizeof(entry))))
+        return false;
+
+    _offset += size;
+    _framesWritten++;
+    _bytesWritten += entry.size;
+
+    return true;
+}
+
+void
+RecordingWriter::run()
+{
+    bool failed = false;
+
+    for (;;) {
+        uint32_t slot;
+        if (!_filled->pop(slot)) {
+            if (_stop)
+                break;
+
+            std::unique_lock lock(_wakeMutex);
+            _wake.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        if (!failed && !write(slot)) {
+            fmt::println(
+              stderr, "Writing recording failed: {}", strerror(errno));
+            failed = true;
+        }
+
+        if (failed)
+            _framesDropped++;
+
+        _free->push(slot);
+    }
+}
+
+void
+RecordingWriter::close()
+{
+    if (_thread.joinable()) {
+        _stop = true;
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    if (_dataFd >= 0) {
+        // release the preallocated blocks past the last frame
+        if (0 != ftruncate(_dataFd, static_cast<off_t>(_offset)))
+            fmt::println(
+              stderr, "Truncating recording failed: {}", strerror(errno));
+        ::close(_dataFd);
+    }
+    if (_indexFd >= 0)
+        ::close(_indexFd);
+
+    std::free(_slots);
+
+    _dataFd = _indexFd = -1;
+    _slots = nullptr;
+    _slotEntries.clear();
+    _free = nullptr;
+    _filled = nullptr;
+}
+
+RecordingStatistics
+RecordingWriter::statistics() const
+{
+    RecordingStatistics statistics;
+    statistics.framesWritten = _framesWritten;
+    statistics.bytesWritten = _bytesWritten;
+    statistics.framesDropped = _framesDropped;
+
+    return statistics;
+}
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "frame_ring.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace cv {
+
+/**
+ *  Raw recordings consist of two append-only files: the data file holds the
+ *  frames as delivered by the camera, each starting at a multiple of
+ *  RECORDING_ALIGNMENT, and the index file next to it (see
+ *  recordingIndexPath()) holds a RecordingHeader followed by one
+ *  RecordingIndexEntry per frame. A recording that was cut short is readable
+ *  up to its last complete index entry.
+ */
+constexpr char RECORDING_MAGIC[8] = { 'P', 'C', 'V', 'B', 'R', 'E', 'C', '1' };
+constexpr uint32_t RECORDING_VERSION = 1;
+constexpr size_t RECORDING_ALIGNMENT = 4096;
+
+// RecordingIndexEntry::flags
+constexpr uint32_t RECORDING_FRAME_INCOMPLETE = 1;
+
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    // sizeof(RecordingIndexEntry) of the writer
+    uint32_t entrySize;
+};
+
+struct RecordingIndexEntry
+{
+    // byte offset of the frame in the data file
+    uint64_t offset;
+    // bytes of frame data
+    uint64_t size;
+    // device timestamp in ns
+    uint64_t timestampNs;
+    uint64_t frameId;
+    uint32_t width, height;
+    // PeakPixelFormat of the frame
+    uint32_t pixelFormat;
+    uint32_t flags;
+};
+
+static_assert(sizeof(RecordingHeader) == 16);
+static_assert(sizeof(RecordingIndexEntry) == 48);
+
+inline std::string
+recordingIndexPath(const std::string& path)
+{
+    return path + ".idx";
+}
+
+/**
+ *  Read-only view of a recording, both files are mapped into memory.
+ */
+class RecordingReader
+{
+  private:
+    const uint8_t* _data = nullptr;
+    size_t _dataSize = 0;
+    const uint8_t* _index = nullptr;
+    size_t _indexSize = 0;
+    size_t _numFrames = 0;
+
+  public:
+    RecordingReader() = default;
+    RecordingReader(const RecordingReader&) = delete;
+    RecordingReader& operator=(const RecordingReader&) = delete;
+    ~RecordingReader();
+
+    /**
+     *  Maps the recording at path, returns false if either file is missing or
+     *  the index is not a recording index.
+     */
+    bool open(const std::string& path);
+
+    void close();
+
+    bool isOpened() const { return nullptr != _index; }
+
+    size_t numFrames() const { return _numFrames; }
+
+    const RecordingIndexEntry& entry(size_t frame) const;
+
+    /**
+     *  Frame data of the given frame, nullptr if the data file is shorter
+     *  than its index entry claims.
+     */
+    const uint8_t* frameData(size_t frame) const;
+};
+
+struct RecordingStatistics
+{
+    // frames and bytes of frame data written to disk
+    size_t framesWritten = 0;
+    size_t bytesWritten = 0;
+    // frames dropped because every staging buffer was still waiting for the
+    // disk, or because writing failed
+    size_t framesDropped = 0;
+};
+
+/**
+ *  Appends frames to a recording from a dedicated writer thread. append()
+ *  copies each frame into one of a fixed number of page-aligned staging
+ *  buffers and returns, the writer thread writes them with O_DIRECT into
+ *  extents preallocated ahead of the write position. If no staging buffer is
+ *  free, append() drops the frame instead of waiting for the disk.
+ */
+class RecordingWriter
+{
+  private:
+    int _dataFd = -1, _indexFd = -1;
+    size_t _slotSize = 0;
+    uint8_t* _slots = nullptr;
+    std::vector<RecordingIndexEntry> _slotEntries;
+
+    // staging buffers by index, free ones go back from the writer thread
+    std::unique_ptr<SpscRing<uint32_t>> _free, _filled;
+
+    uint64_t _offset = 0, _allocated = 0;
+    std::atomic_size_t _framesWritten = 0, _bytesWritten = 0,
+                       _framesDropped = 0;
+
+    std::atomic_bool _stop = false;
+    std::thread _thread;
+    // only used for sleeping, the rings carry the data
+    std::mutex _wakeMutex;
+    std::condition_variable _wake;
+
+    void run();
+    bool write(uint32_t slot);
+
+  public:
+    RecordingWriter() = default;
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+    ~RecordingWriter();
+
+    /**
+     *  Creates the recording at path, replacing an existing one, with
+     *  numBuffers staging buffers for frames of up to maxFrameSize bytes.
+     */
+    bool open(const std::string& path, size_t maxFrameSize, size_t numBuffers);
+
+    /**
+     *  Queues entry.size bytes at data for writing, entry.offset is filled in
+     *  by the writer. Returns false if the frame was dropped.
+     */
+    bool append(const void* data, const RecordingIndexEntry& entry);
+
+    /**
+     *  Writes the queued frames and closes the recording.
+     */
+    void close();
+
+    bool isOpened() const { return _dataFd >= 0; }
+
+    RecordingStatistics statistics() const;
+};
+
+}
@@ -1,5 +1,7 @@
 #include "stream_server.hpp"
 
+#include <sstream>
+
 // clang-format off
 
 constexpr uint16_t    DEFAULT_PORT        = 8888;
@@ -26,6 +28,8 @@ main(int argc, char** argv)
     uint camera_index = DEFAULT_CAMIDX;
     uint16_t port = DEFAULT_PORT;
     size_t max_queue = DEFAULT_MAXQUEUE;
+    std::string source;
+    std::string unix_path;
 
     if (const auto env = std::getenv("STREAMSERVER_COMPRESSIONEXT");
         env != nullptr)
@@ -37,13 +41,123 @@ main(int argc, char** argv)
     if (const auto env = std::getenv("STREAMSERVER_CAMIDX"); env != nullptr)
         camera_index = static_cast<uint>(std::stoul(env));
 
+    // several cameras by index or serial number, instead of STREAMSERVER_CAMIDX
+    std::vector<std::string> cameras;
+    if (const auto env = std::getenv("STREAMSERVER_CAMERAS"); env != nullptr) {
+        std::istringstream list(env);
+        for (std::string camera; std::getline(list, camera, ',');)
+            if (!camera.empty())
+                cameras.push_back(camera);
+    }
+    if (cameras.empty())
+        cameras.push_back(std::to_string(camera_index));
+
     if (const auto env = std::getenv("STREAMSERVER_PORT"); env != nullptr)
         port = static_cast<uint16_t>(std::stoul(env));
 
     if (const auto env = std::getenv("STREAMSERVER_MAXQUEUE"); env != nullptr)
         max_queue = std::stoull(env);
 
-    XVII::StreamServer streamServer(camera_index, max_queue, compression_ext, target_fps);
+    // Prometheus metrics over HTTP, also sent in reply to "metrics"
+    uint16_t metrics_port = 0;
+    if (const auto env = std::getenv("STREAMSERVER_METRICS_PORT");
+        env != nullptr)
+        metrics_port = static_cast<uint16_t>(std::stoul(env));
+
+    // trace spans written on SIGUSR1, also sent in reply to "trace"
+    std::string trace_path;
+    if (const auto env = std::getenv("STREAMSERVER_TRACE_PATH"); env != nullptr)
+        trace_path = env;
+
+    // websocket clients on the same host, in addition to the port
+    if (const auto env = std::getenv("STREAMSERVER_UNIX_PATH"); env != nullptr)
+        unix_path = env;
+
+    // synthetic or replayed frames instead of the camera, see simulated.hpp
+    if (const auto env = std::getenv("STREAMSERVER_SOURCE"); env != nullptr)
+        source = env;
+
+    XVII::PipelineConfig pipeline;
+
+    if (const auto env = std::getenv("STREAMSERVER_ENCODERS"); env != nullptr)
+        pipeline.encoders = static_cast<uint>(std::stoul(env));
+
+    if (const auto env = std::getenv("STREAMSERVER_FRAMES_IN_FLIGHT");
+        env != nullptr)
+        pipeline.framesInFlight = std::stoull(env);
+
+    XVII::JpegSettings jpeg;
+
+    if (const auto env = std::getenv("STREAMSERVER_JPEG_QUALITY");
+        env != nullptr) {
+        jpeg.quality = std::stoi(env);
+        if (jpeg.quality < 1 || jpeg.quality > 100) {
+            std::cerr << "STREAMSERVER_JPEG_QUALITY has to be 1 to 100\n";
+            return 1;
+        }
+    }
+
+    if (const auto env = std::getenv("STREAMSERVER_JPEG_SUBSAMPLING");
+        env != nullptr) {
+        jpeg.subsampling = std::stoi(env);
+        if (444 != jpeg.subsampling && 422 != jpeg.subsampling &&
+            440 != jpeg.subsampling && 420 != jpeg.subsampling &&
+            411 != jpeg.subsampling) {
+            std::cerr << "STREAMSERVER_JPEG_SUBSAMPLING has to be one of 444, "
+                         "422, 440, 420 or 411\n";
+            return 1;
+        }
+    }
+
+    if (const auto env = std::getenv("STREAMSERVER_JPEG_FASTDCT");
+        env != nullptr)
+        jpeg.fastDct = std::stoi(env) != 0;
+
+    XVII::DeliveryConfig delivery;
+
+    if (const auto env = std::getenv("STREAMSERVER_MAX_FRAME_AGE");
+        env != nullptr)
+        delivery.maxFrameAge = std::chrono::milliseconds(std::stoul(env));
+
+    if (const auto env = std::getenv("STREAMSERVER_STALL_TIMEOUT");
+        env != nullptr)
+        delivery.stallTimeout = std::chrono::milliseconds(std::stoul(env));
+
+    // raw frames for local processes, see shared_frames.hpp
+    std::string shared_frames;
+
+    if (const auto env = std::getenv("STREAMSERVER_SHM"); env != nullptr)
+        shared_frames = env;
+
+    XVII::SensorRegion region;
+
+    // clang-format off
+
+    const std::pair<const char*, std::optional<int>*> region_env[] = {
+        { "STREAMSERVER_BINNING",    &region.binning    },
+        { "STREAMSERVER_DECIMATION", &region.decimation },
+        { "STREAMSERVER_WIDTH",      &region.width      },
+        { "STREAMSERVER_HEIGHT",     &region.height     },
+        { "STREAMSERVER_OFFSETX",    &region.offsetX    },
+        { "STREAMSERVER_OFFSETY",    &region.offsetY    },
+    };
+
+    // clang-format on
+
+    for (const auto& [name, value] : region_env)
+        if (const auto env = std::getenv(name); env != nullptr)
+            *value = std::stoi(env);
+
+    XVII::StreamServer streamServer(cameras,
+                                    max_queue,
+                                    compression_ext,
+                                    target_fps,
+                                    region,
+                                    source,
+                                    pipeline,
+                                    jpeg,
+                                    delivery,
+                                    shared_frames);
 
     __exit_handler = [&streamServer]() {
         if (!__server_stopped) {
@@ -62,7 +176,7 @@ main(int argc, char** argv)
     std::signal(SIGINT, signal_handler);
     std::signal(SIGTERM, signal_handler);
 
-    streamServer.run(port);
+    streamServer.run(port, unix_path, metrics_port, trace_path);
 
     return 0;
 }
\ No newline at end of file
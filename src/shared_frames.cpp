@@ -0,0 +1,462 @@
+#include "shared_frames.hpp"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fmt/core.h>
+
+namespace cv {
+
+namespace {
+
+/**
+ *  Start of the shared memory object, the slots follow at SLOTS_OFFSET. Only
+ *  lock-free atomics are used, they work across processes.
+ */
+struct RingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numSlots;
+    // bytes from one slot to the next and frame bytes per slot
+    uint64_t slotStride;
+    uint64_t slotCapacity;
+
+    // sequence of the newest complete frame, 0 before the first
+    alignas(64) std::atomic<uint64_t> published;
+    // incremented with every frame and on close, readers wait on it
+    std::atomic<uint32_t> futex;
+    std::atomic<uint32_t> closed;
+};
+
+/**
+ *  Start of every slot, the frame data follows at SLOT_DATA_OFFSET.
+ */
+struct SlotHeader
+{
+    // sequence of the frame in the slot, 0 while it is being written
+    std::atomic<uint64_t> sequence;
+    uint64_t size;
+    uint64_t frameId, timestampNs;
+    uint32_t width, height;
+    uint32_t pixelFormat;
+    uint32_t incomplete;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+constexpr size_t SLOTS_OFFSET = 4096;
+constexpr size_t SLOT_DATA_OFFSET = 64;
+
+static_assert(sizeof(RingHeader) <= SLOTS_OFFSET);
+static_assert(sizeof(SlotHeader) <= SLOT_DATA_OFFSET);
+
+std::string
+objectName(const std::string& name)
+{
+    return '/' == name.front() ? name : '/' + name;
+}
+
+RingHeader&
+ring(void* memory)
+{
+    return *static_cast<RingHeader*>(memory);
+}
+
+SlotHeader&
+slot(void* memory, uint64_t sequence)
+{
+    auto& header = ring(memory);
+    auto* base = static_cast<uint8_t*>(memory) + SLOTS_OFFSET;
+
+    return *reinterpret_cast<SlotHeader*>(
+      base + (sequence % header.numSlots) * header.slotStride);
+}
+
+void
+futexWake(std::atomic<uint32_t>& word)
+{
+    // not FUTEX_PRIVATE_FLAG, the waiters are other processes
+    syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/**
+ *  Applies cmd to an open file description lock of len bytes from start,
+ *  which are the lock bytes of readers, not the bytes they overlap.
+ */
+bool
+readerLock(int fd, int cmd, struct flock& lock, off_t start, off_t len)
+{
+    lock = {};
+    lock.l_type = F_WRLCK;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = start;
+    lock.l_len = len;
+
+    return 0 == fcntl(fd, cmd, &lock);
+}
+
+bool
+futexWait(std::atomic<uint32_t>& word,
+          uint32_t value,
+          std::chrono::nanoseconds timeout)
+{
+    timespec ts;
+    ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+    ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+
+    // returns right away if the word changed since value was read
+    return 0 == syscall(SYS_futex, &word, FUTEX_WAIT, value, &ts, nullptr, 0) ||
+           ETIMEDOUT != errno;
+}
+
+}
+
+SharedFramePublisher::~SharedFramePublisher()
+{
+    close();
+}
+
+bool
+SharedFramePublisher::open(const std::string& name,
+                           size_t maxFrameSize,
+                           size_t numSlots)
+{
+    close();
+
+    if (name.empty() || numSlots < 2) {
+        fmt::println(stderr, "Shared frames need a name and two slots");
+        return false;
+    }
+
+    _name = objectName(name);
+
+    // readers still attached to a previous ring keep their mapping
+    shm_unlink(_name.c_str());
+
+    int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+    if (fd < 0) {
+        fmt::println(stderr, "Creating {} failed: {}", _name, strerror(errno));
+        return false;
+    }
+
+    // page-aligned slots
+    const size_t stride = (SLOT_DATA_OFFSET + maxFrameSize + SLOTS_OFFSET - 1) &
+                          ~(SLOTS_OFFSET - 1);
+    _mappedSize = SLOTS_OFFSET + numSlots * stride;
+
+    if (ftruncate(fd, static_cast<off_t>(_mappedSize)) < 0) {
+        fmt::println(stderr, "Sizing {} failed: {}", _name, strerror(errno));
+        ::close(fd);
+        shm_unlink(_name.c_str());
+        return false;
+    }
+
+    void* memory =
+      mmap(nullptr, _mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == memory) {
+        fmt::println(stderr, "Mapping {} failed: {}", _name, strerror(errno));
+        ::close(fd);
+        shm_unlink(_name.c_str());
+        return false;
+    }
+
+    // the object is zero-filled, which is a valid state for every atomic
+    auto& header = ring(memory);
+    header.version = SHARED_FRAMES_VERSION;
+    header.numSlots = static_cast<uint32_t>(numSlots);
+    header.slotStride = stride;
+    header.slotCapacity = stride - SLOT_DATA_OFFSET;
+
+    // readers check the magic first, it has to be written last
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header.magic, SHARED_FRAMES_MAGIC, sizeof(header.magic));
+
+    _memory = memory;
+    _fd = fd;
+    _sequence = 0;
+
+    return true;
+}
+
+void
+SharedFramePublisher::close()
+{
+    if (nullptr == _memory)
+        return;
+
+    auto& header = ring(_memory);
+    header.closed.store(1, std::memory_order_release);
+    header.futex.fetch_add(1, std::memory_order_release);
+    futexWake(header.futex);
+
+    munmap(_memory, _mappedSize);
+    ::close(_fd);
+    shm_unlink(_name.c_str());
+
+    _memory = nullptr;
+    _mappedSize = 0;
+    _fd = -1;
+}
+
+bool
+SharedFramePublisher::publish(const SharedFrame& frame)
+{
+    if (nullptr == _memory)
+        return false;
+
+    auto& header = ring(_memory);
+    if (frame.size > header.slotCapacity)
+        return false;
+
+    const uint64_t sequence = ++_sequence;
+    auto& s = slot(_memory, sequence);
+
+    // seqlock: readers of the previous frame in the slot see it is gone
+    s.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s.size = frame.size;
+    s.frameId = frame.frameId;
+    s.timestampNs = frame.timestampNs;
+    s.width = frame.width;
+    s.height = frame.height;
+    s.pixelFormat = frame.pixelFormat;
+    s.incomplete = frame.incomplete;
+    std::memcpy(reinterpret_cast<uint8_t*>(&s) + SLOT_DATA_OFFSET,
+                frame.data,
+                frame.size);
+
+    s.sequence.store(sequence, std::memory_order_release);
+    header.published.store(sequence, std::memory_order_release);
+
+    header.futex.fetch_add(1, std::memory_order_release);
+    futexWake(header.futex);
+
+    return true;
+}
+
+uint32_t
+SharedFramePublisher::readers() const
+{
+    if (nullptr == _memory)
+        return 0;
+
+    // each lock found is a reader, the next search starts behind it
+    uint32_t readers = 0;
+    struct flock lock;
+    for (off_t start = 0; start < SHARED_FRAMES_MAX_READERS;
+         start = lock.l_start + lock.l_len) {
+        if (!readerLock(_fd,
+                        F_OFD_GETLK,
+                        lock,
+                        start,
+                        SHARED_FRAMES_MAX_READERS - start) ||
+            F_UNLCK == lock.l_type)
+            break;
+
+        readers++;
+    }
+
+    return readers;
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    close();
+}
+
+bool
+SharedFrameReader::open(const std::string& name)
+{
+    close();
+
+    if (name.empty())
+        return false;
+
+    const auto objName = objectName(name);
+
+    // read-write for the futex and the lock
+    int fd = shm_open(objName.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < SLOTS_OFFSET) {
+        ::close(fd);
+        return false;
+    }
+
+    _mappedSize = static_cast<size_t>(st.st_size);
+    void* memory =
+      mmap(nullptr, _mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (MAP_FAILED == memory) {
+        ::close(fd);
+        _mappedSize = 0;
+        return false;
+    }
+
+    auto& header = ring(memory);
+    const bool valid =
+      0 == std::memcmp(header.magic, SHARED_FRAMES_MAGIC, sizeof(header.magic));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if (!valid || header.version != SHARED_FRAMES_VERSION ||
+        SLOTS_OFFSET + header.numSlots * header.slotStride > _mappedSize) {
+        munmap(memory, _mappedSize);
+        ::close(fd);
+        _mappedSize = 0;
+        return false;
+    }
+
+    // the first lock byte not held by another reader
+    struct flock lock;
+    off_t lockByte = 0;
+    while (lockByte < SHARED_FRAMES_MAX_READERS &&
+           !readerLock(fd, F_OFD_SETLK, lock, lockByte, 1))
+        lockByte++;
+
+    if (SHARED_FRAMES_MAX_READERS == lockByte) {
+        fmt::println(stderr, "{} has too many readers", objName);
+        munmap(memory, _mappedSize);
+        ::close(fd);
+        _mappedSize = 0;
+        return false;
+    }
+
+    _memory = memory;
+    _fd = fd;
+    // frames published before attaching are not skipped ones
+    _last = header.published.load(std::memory_order_acquire);
+    _skipped = 0;
+
+    return true;
+}
+
+void
+SharedFrameReader::close()
+{
+    if (nullptr == _memory)
+        return;
+
+    munmap(_memory, _mappedSize);
+    // releases the lock
+    ::close(_fd);
+
+    _memory = nullptr;
+    _mappedSize = 0;
+    _fd = -1;
+}
+
+bool
+SharedFrameReader::take(uint64_t sequence, SharedFrame& frame)
+{
+    auto& s = slot(_memory, sequence);
+    if (s.sequence.load(std::memory_order_acquire) != sequence)
+        return false;
+
+    frame.data = reinterpret_cast<const uint8_t*>(&s) + SLOT_DATA_OFFSET;
+    frame.size = s.size;
+    frame.width = s.width;
+    frame.height = s.height;
+    frame.pixelFormat = s.pixelFormat;
+    frame.frameId = s.frameId;
+    frame.timestampNs = s.timestampNs;
+    frame.incomplete = 0 != s.incomplete;
+    frame.sequence = sequence;
+
+    // the metadata has to be from the same frame as well
+    return valid(frame);
+}
+
+bool
+SharedFrameReader::next(SharedFrame& frame, std::chrono::milliseconds timeout)
+{
+    if (nullptr == _memory)
+        return false;
+
+    auto& header = ring(_memory);
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (0 == header.closed.load(std::memory_order_acquire)) {
+        const uint32_t word = header.futex.load(std::memory_order_acquire);
+        const uint64_t published =
+          header.published.load(std::memory_order_acquire);
+
+        if (published > _last) {
+            // the oldest frame that cannot be overwritten right away
+            const uint64_t oldest =
+              published > header.numSlots ? published - header.numSlots + 2 : 1;
+            uint64_t sequence = std::max(_last + 1, oldest);
+
+            for (; sequence <= published; sequence++)
+                if (take(sequence, frame))
+                    break;
+
+            if (sequence <= published) {
+                _skipped += sequence - _last - 1;
+                _last = sequence;
+                return true;
+            }
+
+            // lapped while looking, try again with the new newest frame
+            continue;
+        }
+
+        const auto remaining = deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::nanoseconds::zero() ||
+            !futexWait(header.futex, word, remaining))
+            return false;
+    }
+
+    return false;
+}
+
+bool
+SharedFrameReader::latest(SharedFrame& frame, std::chrono::milliseconds timeout)
+{
+    if (nullptr != _memory) {
+        // everything but the newest frame is skipped
+        const uint64_t published =
+          ring(_memory).published.load(std::memory_order_acquire);
+        if (published > _last + 1) {
+            _skipped += published - _last - 1;
+            _last = published - 1;
+        }
+    }
+
+    return next(frame, timeout);
+}
+
+bool
+SharedFrameReader::valid(const SharedFrame& frame) const
+{
+    if (nullptr == _memory)
+        return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(_memory, frame.sequence)
+             .sequence.load(std::memory_order_relaxed) == frame.sequence;
+}
+
+bool
+SharedFrameReader::closed() const
+{
+    return nullptr != _memory &&
+           0 != ring(_memory).closed.load(std::memory_order_acquire);
+}
+
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cv {
+
+/**
+ *  Raw frames shared with other processes on the same host through a POSIX
+ *  shared memory object: a ring of numSlots frame slots, written by a single
+ *  SharedFramePublisher and mapped read-only in place by any number of
+ *  SharedFrameReaders, which sleep on a futex until the next frame is
+ *  published.
+ *
+ *  A slot is only overwritten numSlots frames later, readers that take
+ *  longer than that to consume a frame can check with valid() whether it was
+ *  overwritten in the meantime.
+ *
+ *  Every attached reader holds an open file description lock on one of the
+ *  first SHARED_FRAMES_MAX_READERS bytes of the object, which the kernel
+ *  releases when the reader exits, crashed or not.
+ */
+constexpr char SHARED_FRAMES_MAGIC[8] = {
+    'P', 'C', 'V', 'B', 'S', 'H', 'M', '1'
+};
+constexpr uint32_t SHARED_FRAMES_VERSION = 2;
+constexpr uint32_t SHARED_FRAMES_MAX_READERS = 64;
+
+struct SharedFrame
+{
+    const void* data = nullptr;
+    size_t size = 0;
+    uint32_t width = 0, height = 0;
+    // PeakPixelFormat of the frame
+    uint32_t pixelFormat = 0;
+    // device frame counter and timestamp in ns
+    uint64_t frameId = 0, timestampNs = 0;
+    bool incomplete = false;
+    // position in the publisher's sequence of frames, counting from 1
+    uint64_t sequence = 0;
+};
+
+class SharedFramePublisher
+{
+  private:
+    void* _memory = nullptr;
+    size_t _mappedSize = 0;
+    // kept open to test the locks of the readers
+    int _fd = -1;
+    std::string _name;
+    uint64_t _sequence = 0;
+
+  public:
+    SharedFramePublisher() = default;
+    SharedFramePublisher(const SharedFramePublisher&) = delete;
+    SharedFramePublisher& operator=(const SharedFramePublisher&) = delete;
+    ~SharedFramePublisher();
+
+    /**
+     *  Creates the shared memory object name (e.g. "/peakcvbridge0"), with
+     *  numSlots slots for frames of up to maxFrameSize bytes. An existing
+     *  object of that name is replaced.
+     */
+    bool open(const std::string& name, size_t maxFrameSize, size_t numSlots);
+
+    /**
+     *  Marks the ring as closed for its readers and removes the name.
+     */
+    void close();
+
+    bool isOpened() const { return nullptr != _memory; }
+
+    /**
+     *  Copies frame.size bytes at frame.data into the next slot and wakes the
+     *  readers. Returns false if the frame is larger than a slot.
+     */
+    bool publish(const SharedFrame& frame);
+
+    /**
+     *  Readers currently attached, readers that exited without close() are
+     *  not counted. Takes one system call per reader.
+     */
+    uint32_t readers() const;
+};
+
+class SharedFrameReader
+{
+  private:
+    void* _memory = nullptr;
+    size_t _mappedSize = 0;
+    // holds the lock that marks the reader as attached
+    int _fd = -1;
+    uint64_t _last = 0, _skipped = 0;
+
+    bool take(uint64_t sequence, SharedFrame& frame);
+
+  public:
+    SharedFrameReader() = default;
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+    ~SharedFrameReader();
+
+    /**
+     *  Attaches to the frames published as name. Returns false if there is no
+     *  such object, it was not created by a SharedFramePublisher or
+     *  SHARED_FRAMES_MAX_READERS readers are attached already.
+     */
+    bool open(const std::string& name);
+
+    void close();
+
+    bool isOpened() const { return nullptr != _memory; }
+
+    /**
+     *  Waits up to timeout for the frame following the one returned last and
+     *  maps it, skipping ahead if it was overwritten already. frame.data
+     *  points into the shared memory. Returns false on timeout or if the
+     *  publisher closed the ring, see closed().
+     */
+    bool next(SharedFrame& frame, std::chrono::milliseconds timeout);
+
+    /**
+     *  Like next(), but skips to the newest published frame.
+     */
+    bool latest(SharedFrame& frame, std::chrono::milliseconds timeout);
+
+    /**
+     *  Whether the slot of frame still holds it, i.e. whether everything
+     *  read from frame.data so far is consistent.
+     */
+    bool valid(const SharedFrame& frame) const;
+
+    /**
+     *  The publisher closed the ring, reopen to attach to a new one.
+     */
+    bool closed() const;
+
+    /**
+     *  Frames published but never returned by next() or latest().
+     */
+    uint64_t skipped() const { return _skipped; }
+};
+
+}
@@ -0,0 +1,452 @@
+#include "simulated.hpp"
+#include "pixel_format.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+#include <opencv2/imgproc.hpp>
+
+namespace cv {
+
+using namespace std::chrono;
+
+SimulatedVideoCapture::SimulatedVideoCapture(const std::string& source,
+                                             bool debayer)
+  : VideoCapture()
+  , _source(source)
+{
+    _debayerMode = debayer ? PEAK_DEBAYER_FULL : PEAK_DEBAYER_NONE;
+}
+
+SimulatedVideoCapture::~SimulatedVideoCapture()
+{
+    SimulatedVideoCapture::release();
+}
+
+bool
+SimulatedVideoCapture::parseSource()
+{
+    std::vector<std::string> tokens;
+    {
+        std::istringstream stream(_source);
+        for (std::string token; std::getline(stream, token, ':');)
+            tokens.push_back(token);
+    }
+
+    if (tokens.empty())
+        return false;
+
+    if (tokens[0] == "synthetic") {
+        if (tokens.size() > 1) {
+            const auto* format = findPixelFormat(tokens[1]);
+            if (nullptr == format ||
+                (format->format != PEAK_PIXEL_FORMAT_MONO8 &&
+                 format->format != PEAK_PIXEL_FORMAT_BAYERRG8))
+                return false;
+
+            _syntheticFormat = format->format;
+        }
+
+        if (tokens.size() > 2) {
+            int width, height;
+            double fps = _fps;
+            const int parsed = std::sscanf(
+              tokens[2].c_str(), "%dx%d@%lf", &width, &height, &fps);
+            if (parsed < 2 || width < 2 || height < 2 || fps < 0.0)
+                return false;
+
+            // whole Bayer quads
+            _width = width & ~1;
+            _height = height & ~1;
+            _fps = fps;
+        }
+
+        return tokens.size() <= 3;
+    }
+
+    if (tokens[0] == "replay" && tokens.size() > 1) {
+        _fast = _loop = false;
+        for (size_t i = 2; i < tokens.size(); i++) {
+            if (tokens[i] == "fast")
+                _fast = true;
+            else if (tokens[i] == "loop")
+                _loop = true;
+            else
+                return false;
+        }
+
+        return _recording.open(tokens[1]);
+    }
+
+    return false;
+}
+
+/**
+ *  Horizontal ramp, vertical ramp and a checkerboard in the three channels,
+ *  repeating every frame width so that any window of it is seamless.
+ */
+void
+SimulatedVideoCapture::generatePattern()
+{
+    Mat bgr(_height, 2 * _width, CV_8UC3);
+    for (int y = 0; y < bgr.rows; y++) {
+        auto* row = bgr.ptr<uchar>(y);
+        for (int x = 0; x < bgr.cols; x++) {
+            const int u = x % _width;
+            row[3 * x + 0] = static_cast<uchar>(u * 256 / _width);
+            row[3 * x + 1] = static_cast<uchar>(y * 256 / _height);
+            row[3 * x + 2] = ((u / 64 + y / 64) & 1) ? 255 : 0;
+        }
+    }
+
+    if (_syntheticFormat == PEAK_PIXEL_FORMAT_MONO8) {
+        cvtColor(bgr, _pattern, COLOR_BGR2GRAY);
+        return;
+    }
+
+    // mosaic the way COLOR_BayerRG2BGR reads it: blue at the top left of
+    // every quad, red at the bottom right
+    _pattern.create(bgr.rows, bgr.cols, CV_8UC1);
+    for (int y = 0; y < bgr.rows; y++) {
+        const auto* in = bgr.ptr<uchar>(y);
+        auto* out = _pattern.ptr<uchar>(y);
+        for (int x = 0; x < bgr.cols; x++) {
+            const int channel = (y & 1) == 0 ? ((x & 1) == 0 ? 0 : 1)
+                                             : ((x & 1) == 0 ? 1 : 2);
+            out[x] = in[3 * x + channel];
+        }
+    }
+}
+
+bool
+SimulatedVideoCapture::open(int, int)
+{
+    release();
+
+    if (!parseSource()) {
+        if (throwOnFail)
+            CV_Error(Error::StsBadArg, "Invalid source: " + _source);
+
+        return false;
+    }
+
+    if (!_recording.isOpened())
+        generatePattern();
+
+    _frameCounters = {};
+    _frameMetadata = {};
+    _lastFrameId.reset();
+    _nextFrame = 0;
+    _start = _deadline = steady_clock::now();
+    _opened = true;
+
+    return true;
+}
+
+void
+SimulatedVideoCapture::release()
+{
+    _opened = false;
+    _grabbed = nullptr;
+    _recording.close();
+    _pattern.release();
+    _frame.release();
+}
+
+bool
+SimulatedVideoCapture::isOpened() const
+{
+    return _opened;
+}
+
+bool
+SimulatedVideoCapture::grabSynthetic()
+{
+    if (_fps > 0.0) {
+        std::this_thread::sleep_until(_deadline);
+
+        const auto now = steady_clock::now();
+        _deadline += duration_cast<steady_clock::duration>(
+          duration<double>(1.0 / _fps));
+
+        // after falling behind, continue from now instead of catching up
+        if (_deadline < now)
+            _deadline = now;
+    }
+
+    // even steps keep the Bayer pattern in place
+    const int shift = static_cast<int>((_frameCounters.delivered * 8) %
+                                       static_cast<size_t>(_width));
+    _pattern.colRange(shift, shift + _width).copyTo(_frame);
+
+    _frameMetadata = {};
+    _frameMetadata.frameId = _frameCounters.delivered;
+    _frameMetadata.timestampNs = static_cast<uint64_t>(
+      duration_cast<nanoseconds>(steady_clock::now() - _start).count());
+
+    _grabbed = _frame.data;
+    _grabbedRows = _frame.rows;
+    _grabbedCols = _frame.cols;
+    _grabbedFormat = _syntheticFormat;
+
+    return true;
+}
+
+bool
+SimulatedVideoCapture::grabReplay()
+{
+    if (_nextFrame >= _recording.numFrames()) {
+        if (!_loop || 0 == _recording.numFrames()) {
+            if (throwOnFail)
+                CV_Error(Error::StsError, "End of recording");
+
+            return false;
+        }
+
+        _nextFrame = 0;
+        _lastFrameId.reset();
+        _start = steady_clock::now();
+    }
+
+    const auto& entry = _recording.entry(_nextFrame);
+
+    if (!_fast) {
+        const auto& first = _recording.entry(0);
+        std::this_thread::sleep_until(
+          _start + nanoseconds(entry.timestampNs - first.timestampNs));
+    }
+
+    const auto* data = _recording.frameData(_nextFrame);
+    const auto* format =
+      describePixelFormat(static_cast<PeakPixelFormat>(entry.pixelFormat));
+    if (nullptr == data || nullptr == format ||
+        entry.size < packedSize(format->packing,
+                                static_cast<size_t>(entry.width) *
+                                  entry.height)) {
+        if (throwOnFail)
+            CV_Error(Error::StsError, "Corrupt frame in recording");
+
+        return false;
+    }
+
+    _nextFrame++;
+
+    if (_lastFrameId && entry.frameId > *_lastFrameId + 1)
+        _frameCounters.lost += entry.frameId - *_lastFrameId - 1;
+    _lastFrameId = entry.frameId;
+
+    _frameMetadata = {};
+    _frameMetadata.frameId = entry.frameId;
+    _frameMetadata.timestampNs = entry.timestampNs;
+    _frameMetadata.incomplete = entry.flags & RECORDING_FRAME_INCOMPLETE;
+    if (_frameMetadata.incomplete)
+        _frameCounters.incomplete++;
+
+    _grabbed = data;
+    _grabbedRows = static_cast<int>(entry.height);
+    _grabbedCols = static_cast<int>(entry.width);
+    _grabbedFormat = format->format;
+
+    return true;
+}
+
+bool
+SimulatedVideoCapture::grab()
+{
+    if (!_opened) {
+        if (throwOnFail)
+            CV_Error(Error::StsError, "Capture is not opened");
+
+        return false;
+    }
+
+    _grabbed = nullptr;
+
+    if (!(_recording.isOpened() ? grabReplay() : grabSynthetic()))
+        return false;
+
+    _frameCounters.delivered++;
+    return true;
+}
+
+bool
+SimulatedVideoCapture::retrieve(OutputArray image, int)
+{
+    if (nullptr == _grabbed) {
+        cv::Mat empty;
+        empty.copyTo(image);
+        return false;
+    }
+
+    convertRawFrame(_grabbed,
+                    _grabbedRows,
+                    _grabbedCols,
+                    *describePixelFormat(_grabbedFormat),
+                    _debayerMode,
+                    _convert8Bit,
+                    _unpacked,
+                    image);
+    _grabbed = nullptr;
+
+    return true;
+}
+
+bool
+SimulatedVideoCapture::retrieve(OutputArray image, FrameMetadata& metadata)
+{
+    metadata = _frameMetadata;
+    return retrieve(image);
+}
+
+bool
+SimulatedVideoCapture::read(OutputArray image)
+{
+    if (grab())
+        return retrieve(image);
+
+    cv::Mat empty;
+    empty.copyTo(image);
+    return false;
+}
+
+bool
+SimulatedVideoCapture::rawFrame(RawFrame& frame) const
+{
+    if (nullptr == _grabbed)
+        return false;
+
+    frame.data = _grabbed;
+    frame.width = _grabbedCols;
+    frame.height = _grabbedRows;
+    frame.pixelFormat = _grabbedFormat;
+    frame.size = packedSize(describePixelFormat(_grabbedFormat)->packing,
+                            static_cast<size_t>(_grabbedCols) *
+                              static_cast<size_t>(_grabbedRows));
+
+    return true;
+}
+
+const FrameMetadata&
+SimulatedVideoCapture::frameMetadata() const
+{
+    return _frameMetadata;
+}
+
+FrameCounters
+SimulatedVideoCapture::frameCounters() const
+{
+    return _frameCounters;
+}
+
+double
+SimulatedVideoCapture::get(int propId) const
+{
+    const bool replay = _recording.isOpened() && _recording.numFrames() > 0;
+
+    switch (propId) {
+        case cv::CAP_PROP_FRAME_WIDTH:
+            return replay ? _recording.entry(0).width : _width;
+        case cv::CAP_PROP_FRAME_HEIGHT:
+            return replay ? _recording.entry(0).height : _height;
+        case cv::CAP_PROP_FPS: {
+            if (!replay)
+                return _fps;
+
+            const auto& first = _recording.entry(0);
+            const auto& last = _recording.entry(_recording.numFrames() - 1);
+            if (last.timestampNs <= first.timestampNs)
+                return 0;
+
+            return 1e9 * static_cast<double>(_recording.numFrames() - 1) /
+                   static_cast<double>(last.timestampNs - first.timestampNs);
+        }
+        case cv::CAP_PROP_POS_MSEC:
+            return static_cast<double>(_frameMetadata.timestampNs) / 1e6;
+        case CAP_PROP_PEAK_FRAME_ID:
+            return static_cast<double>(_frameMetadata.frameId);
+        case CAP_PROP_PEAK_PIXEL_FORMAT:
+            return replay ? _recording.entry(0).pixelFormat : _syntheticFormat;
+        case CAP_PROP_PEAK_DEBAYER_MODE:
+            return _debayerMode;
+        case CAP_PROP_PEAK_CONVERT_8BIT:
+            return _convert8Bit;
+        case CAP_PROP_PEAK_FRAMES_DELIVERED:
+            return static_cast<double>(_frameCounters.delivered);
+        case CAP_PROP_PEAK_FRAMES_LOST:
+            return static_cast<double>(_frameCounters.lost);
+        case CAP_PROP_PEAK_FRAMES_INCOMPLETE:
+            return static_cast<double>(_frameCounters.incomplete);
+    }
+
+    return 0;
+}
+
+bool
+SimulatedVideoCapture::set(int propId, double value)
+{
+    switch (propId) {
+        case cv::CAP_PROP_FRAME_WIDTH:
+        case cv::CAP_PROP_FRAME_HEIGHT: {
+            if (value < 2.0 || _recording.isOpened()) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            // whole Bayer quads
+            const int size = static_cast<int>(value) & ~1;
+            if (propId == cv::CAP_PROP_FRAME_WIDTH)
+                _width = size;
+            else
+                _height = size;
+
+            if (_opened)
+                generatePattern();
+
+            return true;
+        }
+
+        case cv::CAP_PROP_FPS:
+            if (value < 0.0 || _recording.isOpened()) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            _fps = value;
+            _deadline = steady_clock::now();
+            return true;
+
+        case CAP_PROP_PEAK_DEBAYER_MODE:
+            if (value < PEAK_DEBAYER_NONE || value > PEAK_DEBAYER_HALF) {
+                if (throwOnFail)
+                    CV_Error(Error::StsBadArg, "Argument out of range");
+
+                return false;
+            }
+
+            _debayerMode =
+              static_cast<PeakDebayerMode>(static_cast<int>(value));
+            return true;
+
+        case CAP_PROP_PEAK_CONVERT_8BIT:
+            _convert8Bit = 0.0 != value;
+            return true;
+    }
+
+    return false;
+}
+
+std::unique_ptr<VideoCapture>
+createVideoCapture(const std::string& source, bool debayer)
+{
+    if (source.empty())
+        return std::make_unique<PeakVideoCapture>(debayer);
+
+    return std::make_unique<SimulatedVideoCapture>(source, debayer);
+}
+
+}
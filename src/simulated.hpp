@@ -0,0 +1,129 @@
+#pragma once
+
+#include "lib.hpp"
+#include "recording.hpp"
+
+#include <chrono>
+#include <memory>
+
+namespace cv {
+
+/**
+ *  Frame source without camera hardware, with the interface and properties
+ *  of PeakVideoCapture, for benchmarking and testing. The source string
+ *  selects what is delivered:
+ *
+ *  - "synthetic[:<format>[:<width>x<height>[@<fps>]]]":
+ *      A moving test pattern, format being Mono8 (default) or BayerRG8.
+ *      Defaults to 1920x1080@30, a rate of zero delivers frames as fast as
+ *      they are grabbed.
+ *  - "replay:<path>[:fast][:loop]":
+ *      A recording written by peakcvbridge-capture --record, at its original
+ *      timing or, with fast, as fast as possible. With loop, the replay
+ *      restarts at the end of the recording instead of grab() failing.
+ */
+class SimulatedVideoCapture
+  : public VideoCapture
+  , public RawFrameSource
+{
+  private:
+    std::string _source;
+    bool _opened = false;
+    PeakDebayerMode _debayerMode;
+    bool _convert8Bit = false;
+
+    // synthetic source
+    PeakPixelFormat _syntheticFormat = PEAK_PIXEL_FORMAT_MONO8;
+    int _width = 1920, _height = 1080;
+    double _fps = 30.0;
+    // twice as wide as a frame, frames are windows moving across it
+    Mat _pattern;
+    Mat _frame;
+
+    // replay source
+    RecordingReader _recording;
+    bool _fast = false, _loop = false;
+    size_t _nextFrame = 0;
+    std::optional<uint64_t> _lastFrameId;
+
+    std::chrono::steady_clock::time_point _start, _deadline;
+
+    // the grabbed frame, until retrieved
+    const uint8_t* _grabbed = nullptr;
+    int _grabbedRows = 0, _grabbedCols = 0;
+    PeakPixelFormat _grabbedFormat = PEAK_PIXEL_FORMAT_UNKNOWN;
+
+    FrameMetadata _frameMetadata;
+    FrameCounters _frameCounters;
+    Mat _unpacked;
+
+    bool parseSource();
+    void generatePattern();
+    bool grabSynthetic();
+    bool grabReplay();
+
+  public:
+    SimulatedVideoCapture(const std::string& source, bool debayer = false);
+
+    virtual ~SimulatedVideoCapture() override;
+
+    // Opens the source given to the constructor, parameters unused
+    virtual bool open(int = 0, int = 0) override;
+
+    virtual void release() override;
+
+    virtual bool isOpened() const override;
+
+    virtual bool grab() override;
+
+    // Second parameter unused
+    virtual bool retrieve(OutputArray image, int = 0) override;
+
+    bool retrieve(OutputArray image, FrameMetadata& metadata);
+
+    virtual bool read(OutputArray image) override;
+
+    virtual bool rawFrame(RawFrame& frame) const override;
+
+    virtual const FrameMetadata& frameMetadata() const override;
+
+    virtual FrameCounters frameCounters() const override;
+
+    /**
+     *  Implemented properties:
+     *
+     *  - cv::CAP_PROP_FRAME_WIDTH, cv::CAP_PROP_FRAME_HEIGHT:
+     *      Size of the synthetic frames, or of the first recorded frame.
+     *  - cv::CAP_PROP_FPS:
+     *      Synthetic frame rate, or average rate of the recording.
+     *  - cv::CAP_PROP_POS_MSEC, cv::CAP_PROP_PEAK_FRAME_ID:
+     *      Timestamp and frame ID of the last grabbed frame. Synthetic
+     *      timestamps count from open().
+     *  - cv::CAP_PROP_PEAK_PIXEL_FORMAT, cv::CAP_PROP_PEAK_DEBAYER_MODE,
+     *    cv::CAP_PROP_PEAK_CONVERT_8BIT:
+     *      As for PeakVideoCapture.
+     *  - cv::CAP_PROP_PEAK_FRAMES_DELIVERED, cv::CAP_PROP_PEAK_FRAMES_LOST,
+     *    cv::CAP_PROP_PEAK_FRAMES_INCOMPLETE:
+     *      See FrameCounters. Replayed frames count as lost where the
+     *      recorded frame IDs have gaps.
+     */
+    virtual double get(int propId) const override;
+
+    /**
+     *  Implemented properties:
+     *
+     *  - cv::CAP_PROP_FRAME_WIDTH, cv::CAP_PROP_FRAME_HEIGHT, cv::CAP_PROP_FPS:
+     *      Size and rate of the synthetic frames.
+     *  - cv::CAP_PROP_PEAK_DEBAYER_MODE, cv::CAP_PROP_PEAK_CONVERT_8BIT:
+     *      As for PeakVideoCapture.
+     */
+    virtual bool set(int propId, double value) override;
+};
+
+/**
+ *  PeakVideoCapture for an empty source, SimulatedVideoCapture otherwise.
+ */
+std::unique_ptr<VideoCapture>
+createVideoCapture(const std::string& source, bool debayer = false);
+
+}
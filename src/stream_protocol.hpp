@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace XVII {
+
+/**
+ *  Header in front of every frame sent to subscribers that asked for it with
+ *  header=1 (and always for the raw codec). All fields are little-endian,
+ *  the payload follows after headerSize bytes. Newer versions only append
+ *  fields, so clients skip headerSize bytes regardless of the version.
+ */
+constexpr char FRAME_HEADER_MAGIC[4] = { 'P', 'C', 'V', 'F' };
+constexpr uint16_t FRAME_HEADER_VERSION = 1;
+
+enum class FrameCodec : uint8_t
+{
+    // width x height samples of channels x bytesPerSample bytes, row by row
+    RAW = 0,
+    JPEG = 1,
+    PNG = 2,
+    WEBP = 3,
+    // any other cv::imencode() extension
+    OTHER = 255,
+};
+
+struct FrameHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t headerSize;
+    // device frame counter and timestamp, zero if the source has none
+    uint64_t frameId;
+    uint64_t deviceTimestampNs;
+    // server system clock (ns since the UNIX epoch) when the frame was
+    // handed to the subscribers
+    uint64_t sendTimestampNs;
+    // of the payload, after downscaling
+    uint32_t width, height;
+    // cv::PeakPixelFormat of the camera, 0 if unknown or if a Bayer mosaic
+    // was debayered to BGR for downscaling (channels is 3 then)
+    uint32_t pixelFormat;
+    // FrameCodec
+    uint8_t codec;
+    // downscaling factor
+    uint8_t scale;
+    // of the image before encoding, e.g. 2 bytes for unpacked 12-bit
+    uint8_t channels;
+    uint8_t bytesPerSample;
+};
+
+static_assert(sizeof(FrameHeader) == 48, "FrameHeader has to stay packed");
+
+}
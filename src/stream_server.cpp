@@ -1,20 +1,51 @@
 #include "stream_server.hpp"
+#include "debayer.hpp"
 #include "lib.hpp"
+#include "payload_pool.hpp"
+#include "pixel_format.hpp"
+#include "shared_frames.hpp"
+#include "stream_protocol.hpp"
+#include "simulated.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
 #include <fmt/core.h>
 #include <functional>
-#include <iterator>
 #include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#include <set>
+#include <signal.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace XVII;
 
+// clang-format off
+
+// the ring for the largest sensors, only the pages frames touch use memory
+constexpr size_t SHARED_FRAME_CAPACITY       = 2 * 4096 * 3072;
+constexpr size_t SHARED_FRAME_SLOTS          = 4;
+constexpr auto   SHARED_FRAMES_POLL_INTERVAL = std::chrono::milliseconds(500);
+// lowest frame rate limit a subscriber may ask for
+constexpr double MIN_FPS                     = 0.001;
+
+// clang-format on
+
 template<>
 struct fmt::formatter<asio::ip::tcp::endpoint> : formatter<string_view>
 {
     auto format(const asio::ip::tcp::endpoint& ep, format_context& ctx) const
       -> format_context::iterator
     {
-        if (ep.address().is_v6())
+        // connections accepted on the unix socket, see upgrade_unix()
+        if (AF_UNIX == ep.data()->sa_family)
+            return format_to(ctx.out(), "unix");
+        else if (ep.address().is_v6())
             return format_to(
               ctx.out(), "[{}]:{}", ep.address().to_string(), ep.port());
         else
@@ -56,78 +87,697 @@ struct fmt::formatter<StreamingStatus> : formatter<string_view>
     }
 };
 
+static bool
+is_jpeg(const std::string& ext)
+{
+    return ".jpg" == ext || ".jpeg" == ext;
+}
+
+static bool
+is_raw(const std::string& ext)
+{
+    return "raw" == ext;
+}
+
+static FrameCodec
+frame_codec(const std::string& ext)
+{
+    if (is_raw(ext))
+        return FrameCodec::RAW;
+    if (is_jpeg(ext))
+        return FrameCodec::JPEG;
+    if (".png" == ext)
+        return FrameCodec::PNG;
+    if (".webp" == ext)
+        return FrameCodec::WEBP;
+    return FrameCodec::OTHER;
+}
+
+/**
+ *  Parses the arguments of a start message, "codec=<ext>", "quality=<n>",
+ *  "scale=<n>", "fps=<n>", "maxage=<ms>" and "header=<0|1>" separated by
+ *  spaces, into subscriber. Returns an error message on failure.
+ */
+static std::optional<std::string>
+parse_start(const std::string& args, Subscriber& subscriber)
+{
+    auto& codec = subscriber.codec;
+    std::optional<int> quality;
+    std::optional<bool> header;
+
+    std::istringstream tokens(args);
+    std::string token;
+    while (tokens >> token) {
+        const auto separator = token.find('=');
+        if (std::string::npos == separator)
+            return fmt::format("expected key=value, got '{}'", token);
+
+        const auto key = token.substr(0, separator);
+        const auto value = token.substr(separator + 1);
+
+        if (value.empty())
+            return fmt::format("missing value for '{}'", key);
+
+        if ("codec" == key && is_raw(value))
+            codec.ext = value;
+        else if ("codec" == key)
+            codec.ext = '.' == value.front() ? value : '.' + value;
+        else if ("header" == key) {
+            if ("0" != value && "1" != value)
+                return fmt::format("header has to be 0 or 1, got '{}'", value);
+            header = "1" == value;
+        } else if ("quality" == key) {
+            try {
+                quality = std::stoi(value);
+            } catch (const std::exception&) {
+                return fmt::format("invalid quality '{}'", value);
+            }
+        } else if ("scale" == key) {
+            try {
+                codec.scale = std::stoi(value);
+            } catch (const std::exception&) {
+                codec.scale = 0;
+            }
+            // each pyramid level halves the resolution
+            if (codec.scale < 1 || codec.scale > 64 ||
+                (codec.scale & (codec.scale - 1)) != 0)
+                return fmt::format("scale has to be a power of two up to 64, "
+                                   "got '{}'",
+                                   value);
+        } else if ("fps" == key) {
+            try {
+                subscriber.fps = std::stod(value);
+            } catch (const std::exception&) {
+                subscriber.fps = -1.0;
+            }
+            // zero for every frame, the period of anything below the
+            // minimum would not fit into a Clock::duration
+            if (!std::isfinite(subscriber.fps) ||
+                (0.0 != subscriber.fps && subscriber.fps < MIN_FPS))
+                return fmt::format(
+                  "fps has to be 0 or at least {}, got '{}'", MIN_FPS, value);
+        } else if ("maxage" == key) {
+            try {
+                subscriber.maxFrameAge =
+                  std::chrono::milliseconds(std::stoul(value));
+            } catch (const std::exception&) {
+                return fmt::format("invalid maxage '{}'", value);
+            }
+        } else
+            return fmt::format("unknown parameter '{}'", key);
+    }
+
+    if (is_raw(codec.ext)) {
+        // without the header there is no way to interpret the samples
+        if (header && !*header)
+            return "the raw codec is always sent with header";
+        codec.framed = true;
+    } else if (!cv::haveImageWriter(codec.ext))
+        return fmt::format("unsupported codec '{}'", codec.ext);
+    else if (header)
+        codec.framed = *header;
+
+    if (quality) {
+        int param, min = 1, max = 100;
+        if (is_jpeg(codec.ext))
+            param = cv::IMWRITE_JPEG_QUALITY;
+        else if (".webp" == codec.ext)
+            param = cv::IMWRITE_WEBP_QUALITY;
+        else if (".png" == codec.ext) {
+            // higher is smaller and slower
+            param = cv::IMWRITE_PNG_COMPRESSION;
+            min = 0;
+            max = 9;
+        } else
+            return fmt::format("codec '{}' has no quality", codec.ext);
+
+        if (*quality < min || *quality > max)
+            return fmt::format("quality of '{}' has to be {} to {}, got {}",
+                               codec.ext,
+                               min,
+                               max,
+                               *quality);
+
+        codec.params = { param, *quality };
+    }
+
+    return std::nullopt;
+}
+
+/**
+ *  Encodes level into a pooled payload, behind header if the codec is framed.
+ *  JPEG goes through jpegEncoder with the given settings, everything else
+ *  through cv::imencode() into buffer, which keeps its allocation between
+ *  frames. Samples with more than 8 of sampleBits are narrowed to their
+ *  8 most significant bits into narrowed first, unless the codec is raw.
+ */
+static std::shared_ptr<WsServer::OutMessage>
+encode(const cv::Mat& level,
+       int sampleBits,
+       const Codec& codec,
+       FrameHeader header,
+       JpegSettings jpeg,
+       JpegEncoder& jpegEncoder,
+       std::vector<uchar>& buffer,
+       cv::Mat& narrowed,
+       PayloadPool& pool)
+{
+    PEAKCVBRIDGE_SPAN("encode");
+
+    // LSB-aligned 12-bit samples would saturate to white in 8-bit codecs
+    const bool narrow =
+      !is_raw(codec.ext) && CV_16U == level.depth() && sampleBits > 8;
+    if (narrow)
+        level.convertTo(narrowed, CV_8U, 1.0 / (1 << (sampleBits - 8)));
+    const cv::Mat& image = narrow ? narrowed : level;
+
+    header.width = static_cast<uint32_t>(image.cols);
+    header.height = static_cast<uint32_t>(image.rows);
+    header.codec = static_cast<uint8_t>(frame_codec(codec.ext));
+    header.scale = static_cast<uint8_t>(codec.scale);
+    header.channels = static_cast<uint8_t>(image.channels());
+    header.bytesPerSample = static_cast<uint8_t>(image.elemSize1());
+
+    auto payload = [&](const void* data, size_t size) {
+        if (!codec.framed)
+            return pool.acquire(data, size);
+
+        return pool.acquire(std::array<asio::const_buffer, 2>{
+          asio::const_buffer(&header, sizeof(header)),
+          asio::const_buffer(data, size) });
+    };
+
+    if (is_raw(codec.ext)) {
+        if (image.isContinuous())
+            return payload(image.data, image.total() * image.elemSize());
+
+        const cv::Mat continuous = image.clone();
+        return payload(continuous.data,
+                       continuous.total() * continuous.elemSize());
+    }
+
+    if (is_jpeg(codec.ext)) {
+        for (size_t i = 0; i + 1 < codec.params.size(); i += 2)
+            if (cv::IMWRITE_JPEG_QUALITY == codec.params[i])
+                jpeg.quality = codec.params[i + 1];
+
+        const uchar* data;
+        size_t size;
+        if (!jpegEncoder.encode(image, jpeg, data, size))
+            return nullptr;
+
+        return payload(data, size);
+    }
+
+    try {
+        if (!cv::imencode(codec.ext, image, buffer, codec.params))
+            return nullptr;
+    } catch (const cv::Exception& e) {
+        fmt::println(stderr,
+                     "[capture_thread] encoding to {} failed: {}",
+                     codec.ext,
+                     e.what());
+        return nullptr;
+    }
+
+    return payload(buffer.data(), buffer.size());
+}
+
+/**
+ *  Sets FrameHeader::sendTimestampNs of a framed payload, which must not be
+ *  in any send queue yet.
+ */
+static void
+stamp_send_time(WsServer::OutMessage& payload, uint64_t timestampNs)
+{
+    auto* buffer = static_cast<asio::streambuf*>(payload.rdbuf());
+    // the streambuf's own storage, only exposed as const
+    auto* header =
+      static_cast<uint8_t*>(const_cast<void*>(buffer->data().data()));
+
+    std::memcpy(header + offsetof(FrameHeader, sendTimestampNs),
+                &timestampNs,
+                sizeof(timestampNs));
+}
+
+static bool
+share_frame(const cv::RawFrameSource& source,
+            cv::SharedFramePublisher& publisher)
+{
+    cv::RawFrame frame;
+    if (!source.rawFrame(frame))
+        return false;
+
+    const auto& metadata = source.frameMetadata();
+
+    cv::SharedFrame shared;
+    shared.data = frame.data;
+    shared.size = frame.size;
+    shared.width = static_cast<uint32_t>(frame.width);
+    shared.height = static_cast<uint32_t>(frame.height);
+    shared.pixelFormat = frame.pixelFormat;
+    shared.frameId = metadata.frameId;
+    shared.timestampNs = metadata.timestampNs;
+    shared.incomplete = metadata.incomplete;
+
+    return publisher.publish(shared);
+}
+
+static std::string
+escape_regex(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text) {
+        if (std::string_view(".^$|()[]{}*+?\\").find(c) !=
+            std::string_view::npos)
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+/**
+ *  Removes the socket a previous run left at path, but nothing else that may
+ *  have been put there. Returns false if path is taken by something else.
+ */
+static bool
+remove_socket(const std::string& path)
+{
+    struct stat status;
+    if (0 != ::lstat(path.c_str(), &status))
+        return ENOENT == errno;
+
+    if (!S_ISSOCK(status.st_mode))
+        return false;
+
+    return 0 == ::unlink(path.c_str()) || ENOENT == errno;
+}
+
+static bool
+is_stale(std::chrono::milliseconds maxFrameAge,
+         std::chrono::steady_clock::time_point captured)
+{
+    return maxFrameAge.count() > 0 &&
+           std::chrono::steady_clock::now() - captured > maxFrameAge;
+}
+
+/**
+ *  Whether a subscriber limited to fps is due for a frame captured at
+ *  captured, which it then takes. Only called by the capture thread.
+ */
+static bool
+take_frame(Delivery& delivery,
+           double fps,
+           std::chrono::steady_clock::time_point captured)
+{
+    using namespace std::chrono;
+    const auto nextFrame = delivery.nextFrame.load(std::memory_order_relaxed);
+    if (captured < nextFrame)
+        return false;
+
+    // on schedule, unless it fell behind by a whole period
+    const auto period =
+      duration_cast<steady_clock::duration>(duration<double>(1.0 / fps));
+    auto next = nextFrame + period;
+    if (next <= captured)
+        next = captured + period;
+
+    delivery.nextFrame.store(next, std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ *  Whether the frame of notDue skips subscriber, limited counts the rate
+ *  limited subscribers of the snapshot so far.
+ */
+static bool
+is_skipped(const NotDue& notDue, const Subscriber& subscriber, size_t& limited)
+{
+    if (subscriber.fps <= 0.0)
+        return false;
+
+    const auto position = limited++;
+    return position < notDue.size() && notDue[position];
+}
+
+/**
+ *  Makes the caller the sender of delivery, if nobody is sending.
+ */
+static bool
+claim_send(Delivery& delivery)
+{
+    auto idle = std::chrono::steady_clock::time_point();
+    return delivery.sendStarted.compare_exchange_strong(
+      idle, std::chrono::steady_clock::now());
+}
+
 #define LOG(format, ...)                                                       \
     fmt::println(stderr, "{} -> " format, endpoint, ##__VA_ARGS__)
 
 size_t
-StreamServer::n_subscribers()
+StreamServer::n_subscribers(Camera& camera)
+{
+    return get_subscribers(camera)->size();
+}
+
+void
+StreamServer::remove_subscriber(Camera& camera, WsConnHandle subscriber)
+{
+    std::lock_guard lock(camera.subscribersMutex);
+
+    // closing connections that never subscribed copy nothing
+    auto current = std::atomic_load(&camera.subscribers);
+    if (!current->count(subscriber))
+        return;
+
+    auto next = std::make_shared<SubscriberMap>(*current);
+    next->erase(subscriber);
+
+    std::atomic_store(&camera.subscribers, Subscribers(std::move(next)));
+}
+
+void
+StreamServer::add_subscriber(Camera& camera,
+                             WsConnHandle subscriber,
+                             Subscriber settings)
+{
+    {
+        std::lock_guard lock(camera.subscribersMutex);
+
+        auto next = std::make_shared<SubscriberMap>(
+          *std::atomic_load(&camera.subscribers));
+
+        // a repeated start switches the settings, the delivery state stays
+        if (auto existing = next->find(subscriber); next->end() != existing)
+            settings.delivery = existing->second.delivery;
+        else {
+            settings.delivery = std::make_shared<Delivery>();
+            settings.delivery->id = _nextSubscriberId++;
+        }
+
+        next->insert_or_assign(subscriber, std::move(settings));
+
+        std::atomic_store(&camera.subscribers, Subscribers(std::move(next)));
+    }
+
+    camera.captureThreadCondition.notify_one();
+}
+
+Subscribers
+StreamServer::get_subscribers(Camera& camera)
+{
+    // takes a reference, neither copies nor waits for add or remove
+    return std::atomic_load(&camera.subscribers);
+}
+
+std::string
+StreamServer::delivery_status(Camera& camera, WsConnHandle subscriber)
 {
-    _subscribersMutex.lock();
+    std::shared_ptr<Delivery> delivery;
+
+    auto subscribers = get_subscribers(camera);
+    if (auto it = subscribers->find(subscriber); subscribers->end() != it)
+        delivery = it->second.delivery;
 
-    size_t n = _subscribers.size();
+    if (!delivery)
+        return {};
 
-    _subscribersMutex.unlock();
-    return n;
+    return fmt::format("sent {} frames, skipped {}",
+                       delivery->sent.load(),
+                       delivery->skipped.load());
 }
 
 void
-StreamServer::remove_subscriber(WsConnHandle subscriber)
+StreamServer::deliver(Camera& camera,
+                      const WsConn& conn,
+                      const Subscriber& subscriber,
+                      std::shared_ptr<const Outgoing> frame)
 {
-    _subscribersMutex.lock();
+    auto& delivery = *subscriber.delivery;
 
-    _subscribers.erase(subscriber);
+    // the newer frame replaces the one still waiting
+    if (std::atomic_exchange(&delivery.pending, std::move(frame)))
+        delivery.skipped++;
 
-    _subscribersMutex.unlock();
+    // otherwise the send in progress takes it when it completes
+    if (claim_send(delivery))
+        send_next(
+          camera, conn, subscriber.delivery, subscriber.maxFrameAge);
 }
 
 void
-StreamServer::add_subscriber(WsConnHandle subscriber)
+StreamServer::send_next(Camera& camera,
+                        const WsConn& conn,
+                        std::shared_ptr<Delivery> delivery,
+                        std::chrono::milliseconds maxFrameAge)
 {
-    _subscribersMutex.lock();
+    // only called by the sender of delivery
+    while (true) {
+        auto next = std::atomic_exchange(&delivery->pending,
+                                         std::shared_ptr<const Outgoing>());
 
-    _subscribers.insert(subscriber);
+        if (!next) {
+            delivery->sendStarted = Clock::time_point();
+            // handed over after the exchange above, before becoming idle
+            if (!std::atomic_load(&delivery->pending) || !claim_send(*delivery))
+                return;
+            continue;
+        }
 
-    _subscribersMutex.unlock();
+        if (is_stale(maxFrameAge, next->captured)) {
+            delivery->skipped++;
+            continue;
+        }
 
-    _captureThreadCondition.notify_one();
+        delivery->sendStarted = Clock::now();
+        send_frame(
+          camera, conn, std::move(delivery), maxFrameAge, next->payload);
+        return;
+    }
 }
 
-HandleSet
-StreamServer::get_subscribers()
+void
+StreamServer::send_frame(Camera& camera,
+                         const WsConn& conn,
+                         std::shared_ptr<Delivery> delivery,
+                         std::chrono::milliseconds maxFrameAge,
+                         std::shared_ptr<WsServer::OutMessage> payload)
 {
-    _subscribersMutex.lock();
+    WsConnHandle handle = conn;
+    const auto size = payload->size();
+    const auto started = Clock::now();
+
+    // per frame and subscriber, only what the completion needs is copied
+    conn->send(
+      payload,
+      [this, &camera, handle, delivery, maxFrameAge, size, started](
+        const auto& error) {
+          if (error) {
+              if (auto conn = handle.lock())
+                  fmt::println(stderr,
+                               "[fan_out_thread] {} -> send error: {}",
+                               conn->remote_endpoint(),
+                               error.message());
+              remove_subscriber(camera, handle);
+              return;
+          }
 
-    auto ret = _subscribers;
+          _metrics.observe(Histogram::SEND, Clock::now() - started);
 
-    _subscribersMutex.unlock();
+          delivery->sent++;
+          delivery->bytesSent += size;
 
-    return ret;
+          if (auto conn = handle.lock())
+              send_next(camera, conn, delivery, maxFrameAge);
+      },
+      130);
+}
+
+std::string
+StreamServer::pipeline_status(Camera& camera)
+{
+    std::lock_guard lock(_pipelineMutex);
+
+    return fmt::format("{} frames in flight, {} queued for sending, {} "
+                       "queued for encoding and {} encoding on {} encoders "
+                       "for {} cameras",
+                       camera.inFlight,
+                       camera.sendQueue.size(),
+                       _encodeQueue.size(),
+                       _encoding,
+                       _pipeline.encoders,
+                       _cameras.size());
+}
+
+std::string
+StreamServer::metrics()
+{
+    auto out = _metrics.render();
+    auto it = std::back_inserter(out);
+
+    auto family = [&it](const char* name, const char* type, const char* help) {
+        fmt::format_to(it, "# HELP {} {}\n", name, help);
+        fmt::format_to(it, "# TYPE {} {}\n", name, type);
+    };
+
+    auto perCamera = [&](const char* name,
+                         const char* type,
+                         const char* help,
+                         auto value) {
+        family(name, type, help);
+        for (const auto& camera : _cameras)
+            fmt::format_to(it,
+                           "{}{{camera=\"{}\"}} {}\n",
+                           name,
+                           camera->id,
+                           value(*camera));
+    };
+
+    constexpr auto relaxed = std::memory_order_relaxed;
+
+    perCamera("peakcvbridge_frames_total",
+              "counter",
+              "Frames grabbed.",
+              [&](Camera& camera) { return camera.frames.load(relaxed); });
+    perCamera("peakcvbridge_fps",
+              "gauge",
+              "Frames grabbed per second.",
+              [&](Camera& camera) { return camera.fps.load(relaxed); });
+    perCamera("peakcvbridge_buffer_underruns_total",
+              "counter",
+              "Frames that arrived while no buffer was queued.",
+              [&](Camera& camera) { return camera.underruns.load(relaxed); });
+    perCamera("peakcvbridge_frames_lost_total",
+              "counter",
+              "Frames lost by the data stream.",
+              [&](Camera& camera) { return camera.lost.load(relaxed); });
+    perCamera("peakcvbridge_frames_incomplete_total",
+              "counter",
+              "Frames delivered although not completely filled.",
+              [&](Camera& camera) { return camera.incomplete.load(relaxed); });
+    perCamera("peakcvbridge_subscribers",
+              "gauge",
+              "Subscribed clients.",
+              [&](Camera& camera) { return n_subscribers(camera); });
+
+    struct Row
+    {
+        std::string labels;
+        size_t queueDepth;
+        uint64_t sent, skipped, bytesSent;
+    };
+    std::vector<Row> rows;
+
+    for (const auto& camera : _cameras) {
+        // held for the loop, the snapshot may be replaced meanwhile
+        auto subscribers = get_subscribers(*camera);
+        for (const auto& [handle, subscriber] : *subscribers) {
+            auto conn = handle.lock();
+            if (!conn)
+                continue;
+
+            const auto& delivery = *subscriber.delivery;
+
+            rows.push_back(
+              { fmt::format("camera=\"{}\",subscriber=\"{}\",endpoint=\"{}\"",
+                            camera->id,
+                            delivery.id,
+                            conn->remote_endpoint()),
+                conn->queue_size(),
+                delivery.sent.load(),
+                delivery.skipped.load(),
+                delivery.bytesSent.load() });
+        }
+    }
+
+    auto perSubscriber = [&](const char* name,
+                             const char* type,
+                             const char* help,
+                             auto value) {
+        family(name, type, help);
+        for (const auto& row : rows)
+            fmt::format_to(it, "{}{{{}}} {}\n", name, row.labels, value(row));
+    };
+
+    perSubscriber("peakcvbridge_subscriber_queue_depth",
+                  "gauge",
+                  "Messages queued on the connection.",
+                  [](const Row& row) { return row.queueDepth; });
+    perSubscriber("peakcvbridge_subscriber_frames_sent_total",
+                  "counter",
+                  "Frames sent to the subscriber.",
+                  [](const Row& row) { return row.sent; });
+    perSubscriber("peakcvbridge_subscriber_frames_skipped_total",
+                  "counter",
+                  "Frames the subscriber skipped, being too slow for them.",
+                  [](const Row& row) { return row.skipped; });
+    perSubscriber("peakcvbridge_subscriber_bytes_sent_total",
+                  "counter",
+                  "Payload bytes sent to the subscriber.",
+                  [](const Row& row) { return row.bytesSent; });
+
+    return out;
 }
 
 void
-StreamServer::capture_thread()
+StreamServer::capture_thread(Camera& camera)
 {
 #define sleep(ms) std::this_thread::sleep_for(std::chrono::milliseconds((ms)))
 
-    auto compression = _compressionExt.value_or(".jpg");
     auto targetFps = _targetFps.value_or(10.0);
 
-    _threadStatus.store(StreamingStatus::STARTING);
+    PEAKCVBRIDGE_TRACE_THREAD(fmt::format("capture {}", camera.id));
+
+    camera.status.store(StreamingStatus::STARTING);
 
-    cv::PeakVideoCapture capture;
+    auto capturePtr = cv::createVideoCapture(_source);
+    auto& capture = *capturePtr;
+    // frame IDs and device timestamps, if the capture provides them
+    const auto* rawSource =
+      dynamic_cast<const cv::RawFrameSource*>(capturePtr.get());
+    uint32_t pixelFormat = 0;
 
-    while (!_shouldThreadStop.test_and_set()) {
-        _shouldThreadStop.clear();
+    // exists while idle, attaching readers start the capture
+    cv::SharedFramePublisher publisher;
+    size_t sharedCapacity = SHARED_FRAME_CAPACITY;
+    if (!camera.sharedFrames.empty() && nullptr != rawSource &&
+        publisher.open(
+          camera.sharedFrames, sharedCapacity, SHARED_FRAME_SLOTS))
+        fmt::println(stderr,
+                     "[capture_thread {}] publishing frames as {}",
+                     camera.id,
+                     camera.sharedFrames);
+
+    // the serial number of a connected camera, otherwise an index
+    std::optional<int> index;
+    try {
+        if (!camera.id.empty() &&
+            camera.id.find_first_not_of("0123456789") == std::string::npos)
+            index = std::stoi(camera.id);
+    } catch (const std::out_of_range&) {
+        // a serial number only
+    }
+    auto* peakCapture = dynamic_cast<cv::PeakVideoCapture*>(capturePtr.get());
 
-        if (n_subscribers() == 0) {
-            if (StreamingStatus::IDLE != _threadStatus.load())
-                fmt::println(stderr, "[capture_thread] idle");
+    // achieved frame rate, over at least a second
+    uint64_t frames = 0, rateFrames = 0;
+    auto rateStarted = Clock::now();
 
-            _threadStatus.store(StreamingStatus::IDLE);
+    while (!_shouldThreadStop.load()) {
+        if (n_subscribers(camera) == 0 && 0 == publisher.readers()) {
+            if (StreamingStatus::IDLE != camera.status.load())
+                fmt::println(stderr, "[capture_thread {}] idle", camera.id);
+
+            camera.status.store(StreamingStatus::IDLE);
             capture.release();
 
-            std::unique_lock lock(_captureThreadConditionMutex);
-            _captureThreadCondition.wait(lock);
+            // readers attach without notifying, they are polled for
+            std::unique_lock lock(camera.captureThreadConditionMutex);
+            if (publisher.isOpened())
+                camera.captureThreadCondition.wait_for(
+                  lock, SHARED_FRAMES_POLL_INTERVAL);
+            else
+                camera.captureThreadCondition.wait(lock);
 
             continue;
         }
@@ -135,152 +785,826 @@ StreamServer::capture_thread()
         if (!capture.isOpened()) {
             capture.setExceptionMode(true);
             try {
-                capture.open((int)_cameraIndex);
+                std::lock_guard lock(_openMutex);
+
+                int openIndex = index.value_or(-1);
+                if (nullptr != peakCapture)
+                    if (int bySerial = peakCapture->cameraIndex(camera.id);
+                        bySerial >= 0)
+                        openIndex = bySerial;
+
+                capture.open(openIndex);
             } catch (const cv::Exception& e) {
                 if (e.code != cv::Error::StsInternal) {
                     fmt::println(stderr,
-                                 "[capture_thread] unexpected exception when "
-                                 "opening capture: {}",
+                                 "[capture_thread {}] unexpected exception "
+                                 "when opening capture: {}",
+                                 camera.id,
                                  e.what());
-                    _threadStatus.store(StreamingStatus::ERROR_UNKNOWN);
+                    camera.status.store(StreamingStatus::ERROR_UNKNOWN);
                 } else
-                    _threadStatus.store(StreamingStatus::ERROR_CAPTURE_IN_USE);
+                    camera.status.store(StreamingStatus::ERROR_CAPTURE_IN_USE);
 
+                // e.g. unplugged, without spinning on it
+                sleep(1000);
                 continue;
             }
-            fmt::println(stderr,
-                         "[capture_thread] opened capture at index {}",
-                         _cameraIndex);
+            fmt::println(
+              stderr, "[capture_thread {}] opened capture", camera.id);
             capture.setExceptionMode(false);
 
+            pixelFormat = static_cast<uint32_t>(
+              capture.get(cv::CAP_PROP_PEAK_PIXEL_FORMAT));
+
+            // before the frame rate, a smaller readout raises its maximum
+            auto setRegion = [&capture, &camera](int propId,
+                                                 std::optional<int> value,
+                                                 const char* name) {
+                if (value && !capture.set(propId, *value))
+                    fmt::println(stderr,
+                                 "[capture_thread {}] setting {} failed",
+                                 camera.id,
+                                 name);
+            };
+
+            // binning and decimation first, they change the valid ROI range
+            setRegion(cv::CAP_PROP_PEAK_BINNING_HORIZONTAL,
+                      _region.binning,
+                      "CAP_PROP_PEAK_BINNING_HORIZONTAL");
+            setRegion(cv::CAP_PROP_PEAK_BINNING_VERTICAL,
+                      _region.binning,
+                      "CAP_PROP_PEAK_BINNING_VERTICAL");
+            setRegion(cv::CAP_PROP_PEAK_DECIMATION_HORIZONTAL,
+                      _region.decimation,
+                      "CAP_PROP_PEAK_DECIMATION_HORIZONTAL");
+            setRegion(cv::CAP_PROP_PEAK_DECIMATION_VERTICAL,
+                      _region.decimation,
+                      "CAP_PROP_PEAK_DECIMATION_VERTICAL");
+            setRegion(
+              cv::CAP_PROP_FRAME_WIDTH, _region.width, "CAP_PROP_FRAME_WIDTH");
+            setRegion(cv::CAP_PROP_FRAME_HEIGHT,
+                      _region.height,
+                      "CAP_PROP_FRAME_HEIGHT");
+            setRegion(cv::CAP_PROP_PEAK_OFFSET_X,
+                      _region.offsetX,
+                      "CAP_PROP_PEAK_OFFSET_X");
+            setRegion(cv::CAP_PROP_PEAK_OFFSET_Y,
+                      _region.offsetY,
+                      "CAP_PROP_PEAK_OFFSET_Y");
+
             if (!capture.set(cv::CAP_PROP_FPS, targetFps))
                 fmt::println(stderr,
-                             "[capture_thread] setting CAP_PROP_FPS failed");
+                             "[capture_thread {}] setting CAP_PROP_FPS failed",
+                             camera.id);
 
             if (!capture.set(cv::CAP_PROP_AUTO_EXPOSURE, true))
-                fmt::println(
-                  stderr,
-                  "[capture_thread] setting CAP_PROP_AUTO_EXPOSURE failed");
+                fmt::println(stderr,
+                             "[capture_thread {}] setting "
+                             "CAP_PROP_AUTO_EXPOSURE failed",
+                             camera.id);
+
+            // subscribers only ever want the newest frame
+            if (!capture.set(cv::CAP_PROP_PEAK_ACQUISITION_MODE,
+                             cv::PEAK_ACQUISITION_LATEST))
+                fmt::println(stderr,
+                             "[capture_thread {}] setting "
+                             "CAP_PROP_PEAK_ACQUISITION_MODE failed",
+                             camera.id);
+
+            // two bytes per sample cover every supported pixel format,
+            // readers see the ring closed and reattach to the larger one
+            const auto frameSize =
+              2 * static_cast<size_t>(capture.get(cv::CAP_PROP_FRAME_WIDTH)) *
+              static_cast<size_t>(capture.get(cv::CAP_PROP_FRAME_HEIGHT));
+            if (publisher.isOpened() && frameSize > sharedCapacity) {
+                sharedCapacity = frameSize;
+                if (!publisher.open(
+                      camera.sharedFrames, sharedCapacity, SHARED_FRAME_SLOTS))
+                    fmt::println(stderr,
+                                 "[capture_thread {}] publishing frames as {} "
+                                 "failed",
+                                 camera.id,
+                                 camera.sharedFrames);
+            }
         }
 
-        _threadStatus.store(StreamingStatus::STREAMING);
+        camera.status.store(StreamingStatus::STREAMING);
 
         cv::Mat image;
-        if (!capture.read(image) || image.empty())
+        bool encode;
+        {
+            auto hasSlot = [this, &camera]() {
+                return camera.inFlight < _pipeline.framesInFlight;
+            };
+
+            // slow encoders do not hold up local readers, while the
+            // pipeline is full frames are only shared
+            std::unique_lock lock(_pipelineMutex);
+            if (0 == publisher.readers())
+                _pipelineCondition.wait(
+                  lock, [&]() { return _pipelineStop || hasSlot(); });
+            if (_pipelineStop)
+                break;
+
+            encode = hasSlot();
+            if (encode && !camera.freeImages.empty()) {
+                image = std::move(camera.freeImages.back());
+                camera.freeImages.pop_back();
+            }
+        }
+
+        auto recycle = [this, &camera, &image]() {
+            std::lock_guard lock(_pipelineMutex);
+            camera.freeImages.push_back(std::move(image));
+        };
+
+        const auto grabStarted = Clock::now();
+        if (!capture.grab()) {
+            recycle();
+            continue;
+        }
+
+        const auto captured = Clock::now();
+        _metrics.observe(Histogram::GRAB_WAIT, captured - grabStarted);
+
+        // the capture may only be queried from this thread
+        camera.frames.store(++frames, std::memory_order_relaxed);
+        if (captured - rateStarted >= std::chrono::seconds(1)) {
+            const std::chrono::duration<double> elapsed =
+              captured - rateStarted;
+            camera.fps.store((frames - rateFrames) / elapsed.count(),
+                             std::memory_order_relaxed);
+            camera.underruns.store(
+              capture.get(cv::CAP_PROP_PEAK_BUFFER_UNDERRUNS),
+              std::memory_order_relaxed);
+            camera.lost.store(capture.get(cv::CAP_PROP_PEAK_FRAMES_LOST),
+                              std::memory_order_relaxed);
+            camera.incomplete.store(
+              capture.get(cv::CAP_PROP_PEAK_FRAMES_INCOMPLETE),
+              std::memory_order_relaxed);
+
+            rateStarted = captured;
+            rateFrames = frames;
+        }
+
+        // undecoded, before the frame is even retrieved
+        if (0 != publisher.readers())
+            share_frame(*rawSource, publisher);
+
+        if (!encode)
+            continue;
+
+        auto subscribers = get_subscribers(camera);
+
+        // frame rate limits, frames nobody receives are not even queued.
+        // beyond the positions of NotDue, the snapshot is copied without
+        // those not due
+        NotDue notDue;
+        size_t due = 0, limited = 0;
+        std::shared_ptr<SubscriberMap> copy;
+        for (const auto& [handle, subscriber] : *subscribers) {
+            if (subscriber.fps <= 0.0 ||
+                take_frame(*subscriber.delivery, subscriber.fps, captured))
+                due++;
+            else if (limited < notDue.size())
+                notDue.set(limited);
+            else {
+                if (!copy)
+                    copy = std::make_shared<SubscriberMap>(*subscribers);
+                copy->erase(handle);
+            }
+
+            if (subscriber.fps > 0.0)
+                limited++;
+        }
+        if (copy) {
+            limited = 0;
+            for (const auto& [handle, subscriber] : *subscribers)
+                if (is_skipped(notDue, subscriber, limited))
+                    copy->erase(handle);
+            notDue.reset();
+            subscribers = std::move(copy);
+        }
+
+        if (0 == due) {
+            recycle();
+            continue;
+        }
+
+        const auto retrieveStarted = Clock::now();
+        const bool retrieved = capture.retrieve(image);
+        _metrics.observe(Histogram::RETRIEVE, Clock::now() - retrieveStarted);
+
+        if (!retrieved || image.empty()) {
+            recycle();
             continue;
+        }
+
+        uint64_t frameId = 0, deviceTimestampNs = 0;
+        if (nullptr != rawSource) {
+            const auto& metadata = rawSource->frameMetadata();
+            frameId = metadata.frameId;
+            deviceTimestampNs = metadata.timestampNs;
+        }
 
-        std::shared_ptr<WsServer::OutMessage> payload;
         {
-            std::vector<uchar> buffer;
-            cv::imencode(compression, image, buffer);
-            payload = std::make_shared<WsServer::OutMessage>(buffer.size());
-            std::move(buffer.begin(),
-                      buffer.end(),
-                      std::ostream_iterator<uchar>(*payload));
+            std::lock_guard lock(_pipelineMutex);
+            camera.inFlight++;
+            _encodeQueue.push_back({ &camera,
+                                     camera.nextSequence++,
+                                     captured,
+                                     frameId,
+                                     deviceTimestampNs,
+                                     pixelFormat,
+                                     std::move(image),
+                                     std::move(subscribers),
+                                     notDue });
         }
+        _pipelineCondition.notify_all();
+    }
+}
+
+void
+StreamServer::encoder_thread()
+{
+    // keep their allocations between frames
+    std::vector<uchar> encodeBuffer;
+    cv::Mat narrowed;
+    JpegEncoder jpegEncoder;
+    std::map<int, cv::Mat> pyramid;
+
+    PEAKCVBRIDGE_TRACE_THREAD("encoder");
+
+    while (true) {
+        EncodeJob job;
+        {
+            std::unique_lock lock(_pipelineMutex);
+            _pipelineCondition.wait(lock, [this]() {
+                return _pipelineStop || !_encodeQueue.empty();
+            });
+            if (_pipelineStop)
+                return;
+
+            job = std::move(_encodeQueue.front());
+            _encodeQueue.pop_front();
+            _encoding++;
+        }
+
+        // averaging neighbours of a mosaic would mix the colours, its first
+        // level is debayered 2x2 quad by quad instead
+        const auto* format = cv::describePixelFormat(
+          static_cast<cv::PeakPixelFormat>(job.pixelFormat));
+        const bool mosaic =
+          nullptr != format && format->bayer && 1 == job.image.channels();
+        const int sampleBits =
+          nullptr != format ? cv::sampleBits(format->packing) : 16;
+
+        // pyramid levels are built on first use, each from the next larger
+        std::set<int> built{ 1 };
+        pyramid[1] = job.image;
+        std::function<const cv::Mat&(int)> level =
+          [&](int scale) -> const cv::Mat& {
+            auto& image = pyramid[scale];
+            if (built.insert(scale).second) {
+                const auto& larger = level(scale / 2);
+                if (larger.cols < 2 || larger.rows < 2)
+                    image = larger;
+                else if (mosaic && 2 == scale)
+                    cv::debayerSuperpixel(
+                      larger, image, cv::COLOR_BayerRG2BGR);
+                else
+                    cv::resize(larger, image, {}, 0.5, 0.5, cv::INTER_AREA);
+            }
+            return image;
+        };
+
+        FrameHeader header = {};
+        std::memcpy(header.magic, FRAME_HEADER_MAGIC, sizeof(header.magic));
+        header.version = FRAME_HEADER_VERSION;
+        header.headerSize = sizeof(FrameHeader);
+        header.frameId = job.frameId;
+        header.deviceTimestampNs = job.deviceTimestampNs;
+        header.pixelFormat = job.pixelFormat;
+
+        // once per codec, codecs nobody receives are never encoded
+        EncodedFrame frame;
+        frame.captured = job.captured;
+        size_t limited = 0;
+        for (const auto& [handle, subscriber] : *job.subscribers) {
+            const auto& codec = subscriber.codec;
+            if (is_skipped(job.notDue, subscriber, limited) ||
+                handle.expired() || frame.payloads.count(codec))
+                continue;
+
+            const auto& image = level(codec.scale);
+            // a debayered level is no longer in the format of the camera
+            header.pixelFormat =
+              mosaic && image.channels() > 1 ? 0 : job.pixelFormat;
+
+            const auto started = Clock::now();
+            auto payload = encode(image,
+                                  sampleBits,
+                                  codec,
+                                  header,
+                                  _jpeg,
+                                  jpegEncoder,
+                                  encodeBuffer,
+                                  narrowed,
+                                  *_payloadPool);
+            _metrics.observe(Histogram::ENCODE, Clock::now() - started);
+
+            std::shared_ptr<const Outgoing> outgoing;
+            if (payload) {
+                _metrics.observe(Histogram::ENCODED_BYTES, payload->size());
+                outgoing = std::make_shared<const Outgoing>(
+                  Outgoing{ std::move(payload), job.captured });
+            }
+            frame.payloads.emplace(codec, std::move(outgoing));
+        }
+        frame.subscribers = std::move(job.subscribers);
+        frame.notDue = job.notDue;
+        pyramid[1].release();
+
+        {
+            std::lock_guard lock(_pipelineMutex);
+            _encoding--;
+            job.camera->freeImages.push_back(std::move(job.image));
+            job.camera->sendQueue.emplace(job.sequence, std::move(frame));
+        }
+        _pipelineCondition.notify_all();
+    }
+}
+
+void
+StreamServer::fan_out_thread()
+{
+    size_t turn = 0;
+
+    PEAKCVBRIDGE_TRACE_THREAD("fan_out");
+
+    while (true) {
+        Camera* camera = nullptr;
+        EncodedFrame frame;
+        {
+            // the next frame of any camera, which take turns
+            auto ready = [this, &camera, &turn]() {
+                for (size_t i = 0; i < _cameras.size(); i++) {
+                    auto& next = *_cameras[(turn + i) % _cameras.size()];
+                    if (next.sendQueue.count(next.nextToSend)) {
+                        camera = &next;
+                        turn += i + 1;
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            std::unique_lock lock(_pipelineMutex);
+            _pipelineCondition.wait(
+              lock, [&]() { return _pipelineStop || ready(); });
+            if (_pipelineStop)
+                return;
+
+            auto next = camera->sendQueue.find(camera->nextToSend++);
+            frame = std::move(next->second);
+            camera->sendQueue.erase(next);
+            camera->inFlight--;
+        }
+        // a slot for the capture
+        _pipelineCondition.notify_all();
+
+        PEAKCVBRIDGE_SPAN("fan_out");
+
+        using std::chrono::nanoseconds;
+        const auto sendTime = std::chrono::duration_cast<nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch());
+        for (auto& [codec, outgoing] : frame.payloads)
+            if (codec.framed && outgoing)
+                stamp_send_time(*outgoing->payload, sendTime.count());
+
+        // skip whoever stopped while the frame was encoded
+        auto currentSubscribers = get_subscribers(*camera);
+        size_t limited = 0;
+        for (const auto& [handle, subscriber] : *frame.subscribers) {
+            if (is_skipped(frame.notDue, subscriber, limited))
+                continue;
+
+            auto current = currentSubscribers->find(handle);
+            if (currentSubscribers->end() == current)
+                continue;
 
-        auto currentSubscribers = get_subscribers();
-        for (const auto& handle : currentSubscribers) {
             auto conn = handle.lock();
             if (!conn) {
-                remove_subscriber(handle);
+                remove_subscriber(*camera, handle);
+                continue;
+            }
+
+            // slow subscribers skip frames, stalled ones are disconnected
+            const auto& delivery = *current->second.delivery;
+            const auto sendStarted = delivery.sendStarted.load();
+            const bool stalled =
+              Clock::time_point() != sendStarted &&
+              Clock::now() - sendStarted > _delivery.stallTimeout;
+
+            if (stalled || conn->queue_size() > _connMaxQueue) {
+                fmt::println(stderr,
+                             "[fan_out_thread] {} -> closing stalled "
+                             "connection ({} unsent messages)",
+                             conn->remote_endpoint(),
+                             conn->queue_size());
+                conn->send_close(1011, "stalled");
+                remove_subscriber(*camera, handle);
                 continue;
             }
 
-            auto endpoint = conn->remote_endpoint();
-
-            if (conn->queue_size() > _connMaxQueue) {
-                fmt::println(
-                  stderr,
-                  "[capture_thread] {} -> closing connection after {} "
-                  "unsent messages",
-                  endpoint,
-                  _connMaxQueue);
-                conn->send_close(1011, "queue full");
-                remove_subscriber(handle);
+            auto payload = frame.payloads.find(subscriber.codec);
+            if (frame.payloads.end() == payload || !payload->second) {
+                conn->send_close(1011, "encoding failed");
+                remove_subscriber(*camera, handle);
                 continue;
             }
 
-            conn->send(
-              payload,
-              [this, handle, endpoint](const auto& error) {
-                  if (error) {
-                      fmt::println(stderr,
-                                   "[capture_thread] {} -> send error: {}",
-                                   endpoint,
-                                   error.message());
-                      remove_subscriber(handle);
-                  }
-              },
-              130);
+            deliver(*camera, conn, current->second, payload->second);
         }
     }
 }
 
-StreamServer::StreamServer(uint cameraIndex,
+StreamServer::StreamServer(std::vector<std::string> cameras,
                            size_t connMaxQueue,
                            std::optional<std::string> compressionExt,
-                           std::optional<double> targetFps)
+                           std::optional<double> targetFps,
+                           SensorRegion region,
+                           std::string source,
+                           PipelineConfig pipeline,
+                           JpegSettings jpeg,
+                           DeliveryConfig delivery,
+                           std::string sharedFrames)
 {
-    _cameraIndex = cameraIndex;
     _connMaxQueue = connMaxQueue;
     _compressionExt = compressionExt;
     _targetFps = targetFps;
+    _region = region;
+    _source = source;
+    _pipeline = pipeline;
+    _jpeg = jpeg;
+    _delivery = delivery;
+    _pipeline.encoders = std::max(1u, _pipeline.encoders);
+    _pipeline.framesInFlight = std::max<size_t>(1, _pipeline.framesInFlight);
+
+    for (const auto& id : cameras) {
+        auto camera = std::make_unique<Camera>();
+        camera->id = id;
+        if (!sharedFrames.empty())
+            camera->sharedFrames =
+              cameras.size() > 1 ? sharedFrames + '-' + id : sharedFrames;
+
+        serve(*camera, _server.endpoint["^/cam/" + escape_regex(id) + "/?$"]);
+        if (_cameras.empty())
+            serve(*camera, _server.endpoint["^/"]);
 
-    auto& endpoint = _server.endpoint["^/"];
+        _cameras.push_back(std::move(camera));
+    }
+
+    // a payload returns to the pool after its last send completed, so at
+    // most the frames in flight plus a full send queue per codec are used
+    _payloadPool = std::make_shared<PayloadPool>(
+      _cameras.size() * _pipeline.framesInFlight + _connMaxQueue);
+}
 
-    endpoint.on_message = [this](WsConn conn, WsMsg message) {
+void
+StreamServer::serve(Camera& camera, WsServer::Endpoint& endpoint)
+{
+    endpoint.on_message = [this, &camera](WsConn conn, WsMsg message) {
         auto payload = message->string();
         auto endpoint = conn->remote_endpoint();
 
         LOG("message: {}", payload);
 
         if ("status" == payload) {
-            auto status = _threadStatus.load();
-            if (status == StreamingStatus::STREAMING)
-                conn->send(
-                  fmt::format("streaming to {} subscribers", n_subscribers()));
-            else
+            auto status = camera.status.load();
+            if (status == StreamingStatus::STREAMING) {
+                auto reply = fmt::format("streaming to {} subscribers ({})",
+                                         n_subscribers(camera),
+                                         pipeline_status(camera));
+                if (auto delivery = delivery_status(camera, conn);
+                    !delivery.empty())
+                    reply += fmt::format(", to you: {}", delivery);
+                conn->send(reply);
+            } else
                 conn->send(fmt::format("{}", status));
-        } else if ("start" == payload)
-            add_subscriber(conn);
-        else if ("stop" == payload)
-            remove_subscriber(conn);
+        } else if ("start" == payload || 0 == payload.rfind("start ", 0)) {
+            Subscriber subscriber;
+            subscriber.codec.ext = _compressionExt.value_or(".jpg");
+            subscriber.maxFrameAge = _delivery.maxFrameAge;
+            if (auto error = parse_start(payload.substr(5), subscriber)) {
+                LOG("rejected start: {}", *error);
+                conn->send(fmt::format("error: {}", *error));
+            } else
+                add_subscriber(camera, conn, std::move(subscriber));
+        } else if ("stop" == payload)
+            remove_subscriber(camera, conn);
+        else if ("metrics" == payload)
+            conn->send(metrics());
+        else if ("trace" == payload)
+            conn->send(cv::traceJson());
     };
     endpoint.on_close =
-      [this](WsConn conn, int status, const std::string& reason) {
+      [this, &camera](WsConn conn, int status, const std::string& reason) {
           auto endpoint = conn->remote_endpoint();
-          LOG("closed: '{}' ({})", reason, status);
-          remove_subscriber(conn);
+          if (auto delivery = delivery_status(camera, conn); !delivery.empty())
+              LOG("closed: '{}' ({}), {}", reason, status, delivery);
+          else
+              LOG("closed: '{}' ({})", reason, status);
+          remove_subscriber(camera, conn);
       };
-    endpoint.on_error = [this](WsConn conn, const auto& error_code) {
+    endpoint.on_error = [this, &camera](WsConn conn, const auto& error_code) {
         auto endpoint = conn->remote_endpoint();
         LOG("error: {}", error_code.message());
-        remove_subscriber(conn);
+        remove_subscriber(camera, conn);
     };
 }
 
 void
-StreamServer::run(uint16_t port)
+StreamServer::listen_unix()
+{
+    using asio::local::stream_protocol;
+
+    // left behind by a previous run, bind() would fail
+    if (!remove_socket(_unixPath)) {
+        fmt::println(stderr,
+                     "Listening on {} failed: not replacing what is there",
+                     _unixPath);
+        return;
+    }
+
+    auto acceptor =
+      std::make_unique<stream_protocol::acceptor>(*_server.io_service);
+
+    asio::error_code error;
+    acceptor->open(stream_protocol(), error);
+    if (!error) {
+        // 0660 from the start, for local consumers in the group of the
+        // server. The mask is per process, shared frames are 0660 as well.
+        const auto mask = ::umask(0117);
+        acceptor->bind(stream_protocol::endpoint(_unixPath), error);
+        ::umask(mask);
+    }
+    if (!error)
+        acceptor->listen(asio::socket_base::max_listen_connections, error);
+
+    if (error) {
+        fmt::println(
+          stderr, "Listening on {} failed: {}", _unixPath, error.message());
+        return;
+    }
+
+    _unixAcceptor = std::move(acceptor);
+    fmt::println(stderr, "Server listening on {}", _unixPath);
+
+    accept_unix();
+}
+
+void
+StreamServer::accept_unix()
+{
+    auto socket = std::make_shared<asio::local::stream_protocol::socket>(
+      *_server.io_service);
+
+    _unixAcceptor->async_accept(
+      *socket, [this, socket](const asio::error_code& error) {
+          if (asio::error::operation_aborted == error)
+              return;
+
+          if (!error)
+              upgrade_unix(socket);
+          else
+              fmt::println(stderr,
+                           "Accepting on {} failed: {}",
+                           _unixPath,
+                           error.message());
+
+          accept_unix();
+      });
+}
+
+void
+StreamServer::upgrade_unix(
+  std::shared_ptr<asio::local::stream_protocol::socket> socket)
+{
+    auto request = std::make_shared<asio::streambuf>();
+
+    asio::async_read_until(
+      *socket,
+      *request,
+      "\r\n\r\n",
+      [this, socket, request](const asio::error_code& error, size_t) {
+          if (error)
+              return;
+
+          // SWS only knows TCP sockets, but all it does with them works on
+          // any stream socket, so the connection gets the descriptor
+          auto tcpSocket = std::make_unique<asio::ip::tcp::socket>(
+            *_server.io_service);
+          asio::error_code assignError;
+          tcpSocket->assign(
+            asio::ip::tcp::v4(), ::dup(socket->native_handle()), assignError);
+          socket->close();
+          if (assignError) {
+              fmt::println(stderr,
+                           "Upgrading on {} failed: {}",
+                           _unixPath,
+                           assignError.message());
+              return;
+          }
+
+          auto connection =
+            std::make_shared<WsServer::Connection>(std::move(tcpSocket));
+
+          std::istream stream(request.get());
+          if (!SimpleWeb::RequestMessage::parse(stream,
+                                                connection->method,
+                                                connection->path,
+                                                connection->query_string,
+                                                connection->http_version,
+                                                connection->header))
+              return;
+
+          // same endpoints, and thus subscribers, as the TCP connections
+          _server.upgrade(connection);
+      });
+}
+
+void
+StreamServer::listen_metrics(uint16_t port)
 {
-    _captureThreadHandle = std::thread(&StreamServer::capture_thread, this);
+    using asio::ip::tcp;
+
+    auto acceptor = std::make_unique<tcp::acceptor>(*_server.io_service);
+
+    // IPv4 as well
+    asio::error_code error;
+    acceptor->open(tcp::v6(), error);
+    if (!error)
+        acceptor->set_option(asio::ip::v6_only(false), error);
+    if (!error)
+        acceptor->set_option(tcp::acceptor::reuse_address(true), error);
+    if (!error)
+        acceptor->bind(tcp::endpoint(tcp::v6(), port), error);
+    if (!error)
+        acceptor->listen(asio::socket_base::max_listen_connections, error);
+
+    if (error) {
+        fmt::println(stderr,
+                     "Serving metrics on port {} failed: {}",
+                     port,
+                     error.message());
+        return;
+    }
+
+    _metricsAcceptor = std::move(acceptor);
+    fmt::println(stderr, "Serving metrics on port {}", port);
+
+    accept_metrics();
+}
+
+void
+StreamServer::accept_metrics()
+{
+    auto socket = std::make_shared<asio::ip::tcp::socket>(*_server.io_service);
+
+    _metricsAcceptor->async_accept(
+      *socket, [this, socket](const asio::error_code& error) {
+          if (asio::error::operation_aborted == error)
+              return;
+
+          if (!error)
+              respond_metrics(socket);
+
+          accept_metrics();
+      });
+}
+
+void
+StreamServer::respond_metrics(std::shared_ptr<asio::ip::tcp::socket> socket)
+{
+    auto request = std::make_shared<asio::streambuf>();
+
+    // a single request per connection, enough for a scraper
+    asio::async_read_until(
+      *socket,
+      *request,
+      "\r\n\r\n",
+      [this, socket, request](const asio::error_code& error, size_t) {
+          if (error)
+              return;
+
+          std::istream stream(request.get());
+          std::string method, target;
+          stream >> method >> target;
+
+          std::string status = "200 OK", body;
+          if ("GET" != method)
+              status = "405 Method Not Allowed";
+          else if ("/metrics" != target)
+              status = "404 Not Found";
+          else
+              body = metrics();
+
+          auto response = std::make_shared<std::string>(
+            fmt::format("HTTP/1.1 {}\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: {}\r\n"
+                        "Connection: close\r\n\r\n{}",
+                        status,
+                        body.size(),
+                        body));
+
+          asio::async_write(
+            *socket,
+            asio::buffer(*response),
+            [socket, response](const asio::error_code&, size_t) {
+                asio::error_code ignored;
+                socket->shutdown(asio::ip::tcp::socket::shutdown_both,
+                                 ignored);
+            });
+      });
+}
+
+void
+StreamServer::dump_trace_on_signal()
+{
+    _traceSignals->async_wait([this](const asio::error_code& error, int) {
+        if (error)
+            return;
+
+        if (cv::dumpTrace(_tracePath))
+            fmt::println(stderr, "Trace written to {}", _tracePath);
+        else
+            fmt::println(stderr, "Writing the trace to {} failed", _tracePath);
+
+        dump_trace_on_signal();
+    });
+}
+
+void
+StreamServer::run(uint16_t port,
+                  std::string unixPath,
+                  uint16_t metricsPort,
+                  std::string tracePath)
+{
+    _unixPath = unixPath;
+    _tracePath = tracePath;
+
+    for (auto& camera : _cameras)
+        camera->captureThreadHandle =
+          std::thread(&StreamServer::capture_thread, this, std::ref(*camera));
+    for (unsigned int i = 0; i < _pipeline.encoders; i++)
+        _encoderThreads.emplace_back(&StreamServer::encoder_thread, this);
+    _fanOutThreadHandle = std::thread(&StreamServer::fan_out_thread, this);
 
     _server.config.port = port;
     _server.config.thread_pool_size = sysconf(_SC_NPROCESSORS_ONLN);
     _server.config.max_message_size = UINT8_MAX;
-    _server.start([](unsigned short port) {
+    // runs on the io_context of _server, as does everything on the socket
+    _server.start([this, metricsPort](unsigned short port) {
         fmt::println(stderr, "Server listening on port {}", port);
+        if (!_unixPath.empty())
+            listen_unix();
+        if (0 != metricsPort)
+            listen_metrics(metricsPort);
+        if (!_tracePath.empty()) {
+            _traceSignals =
+              std::make_unique<asio::signal_set>(*_server.io_service, SIGUSR1);
+            dump_trace_on_signal();
+        }
     });
 }
 
 void
 StreamServer::stop()
 {
-    _shouldThreadStop.test_and_set();
+    _shouldThreadStop.store(true);
     _server.stop_accept();
+    // the acceptor itself belongs to the io_context threads
+    if (_unixAcceptor)
+        remove_socket(_unixPath);
+
+    {
+        std::lock_guard lock(_pipelineMutex);
+        _pipelineStop = true;
+    }
+    _pipelineCondition.notify_all();
+    for (auto& camera : _cameras)
+        camera->captureThreadCondition.notify_one();
 
-    if (_captureThreadHandle.joinable())
-        _captureThreadHandle.join();
+    for (auto& camera : _cameras)
+        if (camera->captureThreadHandle.joinable())
+            camera->captureThreadHandle.join();
+    for (auto& thread : _encoderThreads)
+        if (thread.joinable())
+            thread.join();
+    if (_fanOutThreadHandle.joinable())
+        _fanOutThreadHandle.join();
 
     for (const auto& conn : _server.get_connections())
         conn->send_close(1001, "shutdown");
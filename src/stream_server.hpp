@@ -1,20 +1,32 @@
 #pragma once
 
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <set>
 #include <string>
+#include <tuple>
+#include <vector>
 
+#include "jpeg_encoder.hpp"
+#include "metrics.hpp"
+
+#include <opencv2/core.hpp>
 #include <server_ws.hpp>
 
 namespace XVII {
 
+class PayloadPool;
+
 using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
 using WsConn = std::shared_ptr<WsServer::Connection>;
 using WsConnHandle = std::weak_ptr<WsServer::Connection>;
 using WsMsg = std::shared_ptr<WsServer::InMessage>;
-using HandleSet = std::set<WsConnHandle, std::owner_less<WsConnHandle>>;
 
 enum class StreamingStatus
 {
@@ -26,39 +38,279 @@ enum class StreamingStatus
     ERROR_CAPTURE_IN_USE, 
 };
 
+/**
+ *  Sensor readout applied whenever the capture is opened, unset members keep
+ *  the camera defaults. Binning and decimation apply to both directions.
+ */
+struct SensorRegion
+{
+    std::optional<int> binning, decimation;
+    std::optional<int> width, height, offsetX, offsetY;
+};
+
+/**
+ *  Encoding requested by a subscriber. Every frame is encoded once per
+ *  distinct codec among the current subscribers.
+ */
+struct Codec
+{
+    // cv::imencode() extension, e.g. ".jpg", or "raw" for the samples as is
+    std::string ext;
+    // cv::imencode() parameters
+    std::vector<int> params;
+    // downscaling factor, a power of two
+    int scale = 1;
+    // with a FrameHeader in front, see stream_protocol.hpp
+    bool framed = false;
+
+    bool operator<(const Codec& other) const
+    {
+        return std::tie(ext, params, scale, framed) <
+               std::tie(other.ext, other.params, other.scale, other.framed);
+    }
+};
+
+/**
+ *  An encoded frame on its way to the subscribers of its codec.
+ */
+struct Outgoing
+{
+    std::shared_ptr<WsServer::OutMessage> payload;
+    std::chrono::steady_clock::time_point captured;
+};
+
+/**
+ *  Backpressure of a subscriber: at most one frame is being sent, the newest
+ *  frame captured since then waits in pending and replaces older ones.
+ *  Without a lock: pending is only accessed through std::atomic_exchange()
+ *  and std::atomic_load(), and whoever moves sendStarted away from idle
+ *  sends until pending is empty.
+ */
+struct Delivery
+{
+    // start of the send in progress, time_point() while idle
+    std::atomic<std::chrono::steady_clock::time_point> sendStarted{};
+    std::shared_ptr<const Outgoing> pending;
+    std::atomic<uint64_t> sent{ 0 }, skipped{ 0 }, bytesSent{ 0 };
+    // tells subscribers with the same endpoint apart in the metrics
+    uint64_t id = 0;
+    // earliest capture time of the next frame for a limited frame rate,
+    // only used by the capture thread
+    std::atomic<std::chrono::steady_clock::time_point> nextFrame{};
+};
+
+struct Subscriber
+{
+    Codec codec;
+    // frames captured longer ago are skipped, zero for no limit
+    std::chrono::milliseconds maxFrameAge{ 0 };
+    // frames per second, zero for every frame
+    double fps = 0.0;
+    // shared by all snapshots of the subscriber
+    std::shared_ptr<Delivery> delivery;
+};
+
+using SubscriberMap =
+  std::map<WsConnHandle, Subscriber, std::owner_less<WsConnHandle>>;
+// never modified once published, changes publish a modified copy
+using Subscribers = std::shared_ptr<const SubscriberMap>;
+// rate limited subscribers a frame is not for, by their position among the
+// rate limited ones of its snapshot
+using NotDue = std::bitset<64>;
+
+/**
+ *  Frames are encoded by a pool of encoder threads shared by all cameras and
+ *  sent in capture order. Per camera, at most framesInFlight frames are
+ *  queued for encoding, being encoded or waiting to be sent at the same
+ *  time, the capture waits for a free slot.
+ */
+struct PipelineConfig
+{
+    unsigned int encoders = 2;
+    size_t framesInFlight = 4;
+};
+
+/**
+ *  Frames are only skipped for subscribers that cannot keep up, a subscriber
+ *  is disconnected when sending one frame takes longer than stallTimeout.
+ */
+struct DeliveryConfig
+{
+    // default for subscribers not requesting one, zero for no limit
+    std::chrono::milliseconds maxFrameAge{ 0 };
+    std::chrono::milliseconds stallTimeout{ 10000 };
+};
+
 class StreamServer
 {
   private:
-    unsigned int _cameraIndex;
+    using Clock = std::chrono::steady_clock;
+
+    struct Camera;
+
+    struct EncodeJob
+    {
+        Camera* camera;
+        uint64_t sequence;
+        Clock::time_point captured;
+        // for the FrameHeader
+        uint64_t frameId, deviceTimestampNs;
+        uint32_t pixelFormat;
+        cv::Mat image;
+        Subscribers subscribers;
+        NotDue notDue;
+    };
+
+    struct EncodedFrame
+    {
+        Clock::time_point captured;
+        Subscribers subscribers;
+        NotDue notDue;
+        std::map<Codec, std::shared_ptr<const Outgoing>> payloads;
+    };
+
+    /**
+     *  A camera with its own subscribers and capture thread, opened while
+     *  it has subscribers. The encoders and the fan-out serve all cameras.
+     */
+    struct Camera
+    {
+        // index or serial number, served at /cam/<id>
+        std::string id;
+        // shared memory object raw frames are published as, empty for none
+        std::string sharedFrames;
+
+        // read with std::atomic_load(), only changing them takes the lock
+        std::mutex subscribersMutex;
+        Subscribers subscribers = std::make_shared<const SubscriberMap>();
+
+        std::atomic<StreamingStatus> status = StreamingStatus::NOT_STREAMING;
+
+        // for the metrics, written by the capture thread only
+        std::atomic<uint64_t> frames = 0;
+        std::atomic<double> fps = 0.0;
+        std::atomic<uint64_t> underruns = 0, lost = 0, incomplete = 0;
+
+        std::thread captureThreadHandle;
+        std::condition_variable captureThreadCondition;
+        std::mutex captureThreadConditionMutex;
+
+        // the rest is guarded by _pipelineMutex
+        // frames queued for encoding, being encoded or waiting to be sent
+        size_t inFlight = 0;
+        // encoded frames by sequence number, sent in order
+        std::map<uint64_t, EncodedFrame> sendQueue;
+        uint64_t nextSequence = 0, nextToSend = 0;
+        // recycled capture buffers
+        std::vector<cv::Mat> freeImages;
+    };
+
     size_t _connMaxQueue;
     std::optional<std::string> _compressionExt;
     std::optional<double> _targetFps;
+    SensorRegion _region;
+    // see cv::createVideoCapture(), empty for the cameras
+    std::string _source;
 
-    std::recursive_mutex _subscribersMutex;
-    HandleSet _subscribers;
+    std::vector<std::unique_ptr<Camera>> _cameras;
+    // opening updates the device list of the peak library
+    std::mutex _openMutex;
 
     WsServer _server;
+    // after _server, it has to go before the io_context of _server
+    std::unique_ptr<asio::local::stream_protocol::acceptor> _unixAcceptor;
+    std::string _unixPath;
+    std::unique_ptr<asio::ip::tcp::acceptor> _metricsAcceptor;
+    std::unique_ptr<asio::signal_set> _traceSignals;
+    std::string _tracePath;
+
+    std::atomic<bool> _shouldThreadStop = false;
+
+    PipelineConfig _pipeline;
+    // for .jpg, a quality requested with start takes precedence
+    JpegSettings _jpeg;
+    DeliveryConfig _delivery;
+    std::shared_ptr<PayloadPool> _payloadPool;
+    Metrics _metrics;
+    std::atomic<uint64_t> _nextSubscriberId = 1;
+    std::vector<std::thread> _encoderThreads;
+    std::thread _fanOutThreadHandle;
+
+    // guards everything below, one condition for all stages
+    std::mutex _pipelineMutex;
+    std::condition_variable _pipelineCondition;
+    bool _pipelineStop = false;
+    std::deque<EncodeJob> _encodeQueue;
+    size_t _encoding = 0;
+
+    size_t n_subscribers(Camera& camera);
+    void remove_subscriber(Camera& camera, WsConnHandle subscriber);
+    void add_subscriber(Camera& camera,
+                        WsConnHandle subscriber,
+                        Subscriber settings);
+    Subscribers get_subscribers(Camera& camera);
+    std::string delivery_status(Camera& camera, WsConnHandle subscriber);
+
+    void deliver(Camera& camera,
+                 const WsConn& conn,
+                 const Subscriber& subscriber,
+                 std::shared_ptr<const Outgoing> frame);
+    void send_next(Camera& camera,
+                   const WsConn& conn,
+                   std::shared_ptr<Delivery> delivery,
+                   std::chrono::milliseconds maxFrameAge);
+    void send_frame(Camera& camera,
+                    const WsConn& conn,
+                    std::shared_ptr<Delivery> delivery,
+                    std::chrono::milliseconds maxFrameAge,
+                    std::shared_ptr<WsServer::OutMessage> payload);
+
+    std::string pipeline_status(Camera& camera);
+    std::string metrics();
+
+    void serve(Camera& camera, WsServer::Endpoint& endpoint);
 
-    std::atomic_flag _shouldThreadStop = ATOMIC_FLAG_INIT;
-    std::atomic<StreamingStatus> _threadStatus = StreamingStatus::NOT_STREAMING;
+    void capture_thread(Camera& camera);
+    void encoder_thread();
+    void fan_out_thread();
 
-    std::thread _captureThreadHandle;
-    std::condition_variable _captureThreadCondition;
-    std::mutex _captureThreadConditionMutex;
+    void listen_unix();
+    void accept_unix();
+    void upgrade_unix(
+      std::shared_ptr<asio::local::stream_protocol::socket> socket);
 
-    size_t n_subscribers();
-    void remove_subscriber(WsConnHandle subscriber);
-    void add_subscriber(WsConnHandle subscriber);
-    HandleSet get_subscribers();
+    void listen_metrics(uint16_t port);
+    void accept_metrics();
+    void respond_metrics(std::shared_ptr<asio::ip::tcp::socket> socket);
 
-    void capture_thread();
+    void dump_trace_on_signal();
 
   public:
-    StreamServer(uint cameraIndex = 0,
+    /**
+     *  Serves each of cameras, given by index or serial number, at
+     *  /cam/<camera> and the first one at / as well. With more than one
+     *  camera, sharedFrames is suffixed by -<camera>.
+     */
+    StreamServer(std::vector<std::string> cameras = { "0" },
                  size_t connMaxQueue = 10,
                  std::optional<std::string> compressionExt = std::nullopt,
-                 std::optional<double> targetFps = std::nullopt);
-    void run(uint16_t port);
+                 std::optional<double> targetFps = std::nullopt,
+                 SensorRegion region = {},
+                 std::string source = {},
+                 PipelineConfig pipeline = {},
+                 JpegSettings jpeg = {},
+                 DeliveryConfig delivery = {},
+                 std::string sharedFrames = {});
+    /**
+     *  Serves websocket clients on port and, unless unixPath is empty, on
+     *  a unix socket at unixPath, until stop() is called. Unless metricsPort
+     *  is zero, the metrics are served over HTTP at /metrics on it. Unless
+     *  tracePath is empty, SIGUSR1 writes the trace spans to it.
+     */
+    void run(uint16_t port,
+             std::string unixPath = {},
+             uint16_t metricsPort = 0,
+             std::string tracePath = {});
     void stop();
 };
 
@@ -0,0 +1,208 @@
+#include "trace.hpp"
+
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fmt/core.h>
+
+namespace cv {
+
+struct TraceEvent
+{
+    std::atomic<const char*> name{ nullptr };
+    std::atomic<uint64_t> start{ 0 }, end{ 0 };
+};
+
+/**
+ *  The ring of one thread, only written by it. Like a seqlock, written is
+ *  published after an event and a reader drops whatever the thread may have
+ *  been overwriting while it was copied.
+ */
+struct ThreadTrace
+{
+    pid_t tid;
+    // guarded by the mutex of the Traces
+    std::string name;
+
+    std::atomic<uint64_t> written{ 0 };
+    std::array<TraceEvent, TRACE_EVENTS> events;
+};
+
+struct Traces
+{
+    std::mutex mutex;
+    // outlive their threads, the last spans of a thread stay in the trace
+    std::vector<std::unique_ptr<ThreadTrace>> threads;
+};
+
+static Traces&
+traces()
+{
+    static Traces traces;
+    return traces;
+}
+
+static ThreadTrace&
+localTrace()
+{
+    // only the first span of a thread takes the lock
+    thread_local ThreadTrace* trace = nullptr;
+
+    if (nullptr == trace) {
+        auto owned = std::make_unique<ThreadTrace>();
+        owned->tid = static_cast<pid_t>(::syscall(SYS_gettid));
+
+        char name[16] = {};
+        if (0 == pthread_getname_np(pthread_self(), name, sizeof(name)))
+            owned->name = name;
+
+        auto& all = traces();
+        std::lock_guard lock(all.mutex);
+        trace = all.threads.emplace_back(std::move(owned)).get();
+    }
+
+    return *trace;
+}
+
+static void
+appendJsonString(std::string& out, const std::string& value)
+{
+    out += '"';
+    for (char c : value) {
+        if ('"' == c || '\\' == c)
+            out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20)
+            fmt::format_to(
+              std::back_inserter(out), "\\u{:04x}", static_cast<int>(c));
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+uint64_t
+traceClock()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void
+traceSpan(const char* name, uint64_t start, uint64_t end)
+{
+    auto& trace = localTrace();
+
+    const auto n = trace.written.load(std::memory_order_relaxed);
+    auto& event = trace.events[n % TRACE_EVENTS];
+
+    // a reader that sees any of the stores below sees n as well
+    std::atomic_thread_fence(std::memory_order_release);
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+
+    trace.written.store(n + 1, std::memory_order_release);
+}
+
+void
+traceThreadName(std::string name)
+{
+    auto& trace = localTrace();
+
+    std::lock_guard lock(traces().mutex);
+    trace.name = std::move(name);
+}
+
+std::string
+traceJson()
+{
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    auto it = std::back_inserter(out);
+    const auto pid = ::getpid();
+    bool first = true;
+
+    auto separate = [&out, &first]() {
+        if (!first)
+            out += ",\n";
+        first = false;
+    };
+
+    auto& all = traces();
+    std::lock_guard lock(all.mutex);
+
+    for (const auto& trace : all.threads) {
+        separate();
+        fmt::format_to(it,
+                       "{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":{},"
+                       "\"tid\":{},\"args\":{{\"name\":",
+                       pid,
+                       trace->tid);
+        appendJsonString(out, trace->name);
+        out += "}}";
+
+        struct Span
+        {
+            const char* name;
+            uint64_t start, end;
+        };
+
+        const auto written = trace->written.load(std::memory_order_acquire);
+        const auto oldest =
+          written > TRACE_EVENTS ? written - TRACE_EVENTS : 0;
+
+        std::vector<Span> spans;
+        spans.reserve(written - oldest);
+        for (uint64_t n = oldest; n < written; n++) {
+            const auto& event = trace->events[n % TRACE_EVENTS];
+            spans.push_back({ event.name.load(std::memory_order_relaxed),
+                              event.start.load(std::memory_order_relaxed),
+                              event.end.load(std::memory_order_relaxed) });
+        }
+
+        // the thread kept recording, its oldest spans may be overwritten
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto now = trace->written.load(std::memory_order_relaxed);
+        const auto valid = now >= TRACE_EVENTS ? now - TRACE_EVENTS + 1 : 0;
+
+        for (uint64_t n = std::max(oldest, valid); n < written; n++) {
+            const auto& span = spans[n - oldest];
+            separate();
+            // in µs
+            fmt::format_to(it,
+                           "{{\"ph\":\"X\",\"name\":\"{}\",\"pid\":{},"
+                           "\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                           span.name,
+                           pid,
+                           trace->tid,
+                           span.start / 1e3,
+                           (span.end - span.start) / 1e3);
+        }
+    }
+
+    out += "]}\n";
+    return out;
+}
+
+bool
+dumpTrace(const std::string& path)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << traceJson();
+    file.close();
+
+    return !file.fail();
+}
+
+}
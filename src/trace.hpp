@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace cv {
+
+/**
+ *  Scoped spans of the capture and streaming pipeline, for finding out where
+ *  a stall comes from. Each thread records its spans into a ring of its own
+ *  that keeps the last TRACE_EVENTS of them, without taking a lock, and
+ *  traceJson() renders all rings in the Chrome trace-event format, which
+ *  Perfetto and chrome://tracing open.
+ *
+ *  Unless built with PEAKCVBRIDGE_TRACE, PEAKCVBRIDGE_SPAN() and
+ *  PEAKCVBRIDGE_TRACE_THREAD() compile to nothing and traces stay empty.
+ */
+constexpr size_t TRACE_EVENTS = 16384;
+
+/**
+ *  Nanoseconds on the clock spans are recorded with.
+ */
+uint64_t
+traceClock();
+
+/**
+ *  Records a span of the calling thread from start to end, as given by
+ *  traceClock(). name is kept as a pointer, a string literal will do.
+ */
+void
+traceSpan(const char* name, uint64_t start, uint64_t end);
+
+/**
+ *  Names the calling thread in traces, instead of its system name.
+ */
+void
+traceThreadName(std::string name);
+
+/**
+ *  The spans of all threads, oldest first, as a JSON object.
+ */
+std::string
+traceJson();
+
+/**
+ *  Writes traceJson() to path, returns false if that failed.
+ */
+bool
+dumpTrace(const std::string& path);
+
+class TraceSpan
+{
+  private:
+    const char* _name;
+    uint64_t _start;
+
+  public:
+    explicit TraceSpan(const char* name)
+      : _name(name)
+      , _start(traceClock())
+    {
+    }
+    ~TraceSpan() { traceSpan(_name, _start, traceClock()); }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+}
+
+#define PEAKCVBRIDGE_TRACE_CONCAT_(a, b) a##b
+#define PEAKCVBRIDGE_TRACE_CONCAT(a, b) PEAKCVBRIDGE_TRACE_CONCAT_(a, b)
+
+#ifdef PEAKCVBRIDGE_TRACE
+// records the rest of the enclosing scope
+#define PEAKCVBRIDGE_SPAN(name)                                                \
+    ::cv::TraceSpan PEAKCVBRIDGE_TRACE_CONCAT(_traceSpan, __LINE__)(name)
+#define PEAKCVBRIDGE_TRACE_THREAD(name) ::cv::traceThreadName(name)
+#else
+#define PEAKCVBRIDGE_SPAN(name) ((void)0)
+#define PEAKCVBRIDGE_TRACE_THREAD(name) ((void)0)
+#endif
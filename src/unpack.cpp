@@ -0,0 +1,489 @@
+#include "unpack.hpp"
+
+#include <cstring>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace cv {
+
+namespace {
+
+/**
+ *  Every packing is handled by a specialization of Unpacker, which converts
+ *  one group of GROUP_PIXELS samples stored in GROUP_BYTES bytes. The simd()
+ *  overloads convert as many whole groups as they can and return how many
+ *  they converted, the remainder goes through the scalar group() overloads.
+ */
+template<PixelPacking P>
+struct Unpacker;
+
+#if CV_SIMD128
+/**
+ *  One sample of each of the eight groups in q, which sample selects from
+ *  the 64-bit lane of a group.
+ */
+template<typename Sample>
+v_uint16x8
+narrowSamples(const v_uint64x2 (&q)[4], Sample sample)
+{
+    return v_pack(v_pack(sample(q[0]), sample(q[1])),
+                  v_pack(sample(q[2]), sample(q[3])));
+}
+#endif
+
+/**
+ *  Five-byte groups of four samples do not map onto the deinterleaving
+ *  loads. Instead, every group is loaded into a 64-bit lane of its own,
+ *  little-endian like the layouts, and U::samples<I, T>() shifts and masks
+ *  sample I out of all lanes at once. The lanes of eight groups are then
+ *  narrowed into one vector per sample and stored interleaved.
+ *
+ *  Each load reads three bytes past its group, so the group after the last
+ *  one converted has to exist.
+ */
+template<typename U>
+int
+simdFiveByteGroups(const uchar* src, ushort* dst, int groups)
+{
+    int g = 0;
+#if CV_SIMD128
+    for (; g <= groups - 9; g += 8) {
+        v_uint64x2 q[4];
+        for (int k = 0; k < 4; k++) {
+            const uchar* group = src + 5 * (g + 2 * k);
+            q[k] = v_reinterpret_as_u64(v_load_halves(group, group + 5));
+        }
+
+        v_store_interleave(dst + 4 * g,
+                           U::template samples<0, ushort>(q),
+                           U::template samples<1, ushort>(q),
+                           U::template samples<2, ushort>(q),
+                           U::template samples<3, ushort>(q));
+    }
+#endif
+    return g;
+}
+
+template<typename U>
+int
+simdFiveByteGroups(const uchar* src, uchar* dst, int groups)
+{
+    int g = 0;
+#if CV_SIMD128
+    for (; g <= groups - 17; g += 16) {
+        v_uint64x2 lo[4], hi[4];
+        for (int k = 0; k < 4; k++) {
+            const uchar* group = src + 5 * (g + 2 * k);
+            lo[k] = v_reinterpret_as_u64(v_load_halves(group, group + 5));
+            hi[k] =
+              v_reinterpret_as_u64(v_load_halves(group + 40, group + 45));
+        }
+
+        v_store_interleave(dst + 4 * g,
+                           v_pack(U::template samples<0, uchar>(lo),
+                                  U::template samples<0, uchar>(hi)),
+                           v_pack(U::template samples<1, uchar>(lo),
+                                  U::template samples<1, uchar>(hi)),
+                           v_pack(U::template samples<2, uchar>(lo),
+                                  U::template samples<2, uchar>(hi)),
+                           v_pack(U::template samples<3, uchar>(lo),
+                                  U::template samples<3, uchar>(hi)));
+    }
+#endif
+    return g;
+}
+
+template<int BITS>
+struct UnpackedUnpacker
+{
+    static constexpr int GROUP_PIXELS = 1;
+    static constexpr int GROUP_BYTES = 2;
+
+    static void group(const uchar* src, ushort* dst)
+    {
+        dst[0] = static_cast<ushort>(src[0] | src[1] << 8);
+    }
+
+    static void group(const uchar* src, uchar* dst)
+    {
+        dst[0] = static_cast<uchar>((src[0] | src[1] << 8) >> (BITS - 8));
+    }
+
+    static int simd(const uchar* src, ushort* dst, int groups)
+    {
+        std::memcpy(dst, src, static_cast<size_t>(groups) * GROUP_BYTES);
+        return groups;
+    }
+
+    static int simd(const uchar* src, uchar* dst, int groups)
+    {
+        int g = 0;
+#if CV_SIMD
+        constexpr int lanes = static_cast<int>(sizeof(v_uint16) / 2);
+        const auto* src16 = reinterpret_cast<const ushort*>(src);
+
+        for (; g <= groups - 2 * lanes; g += 2 * lanes) {
+            v_uint16 a = vx_load(src16 + g), b = vx_load(src16 + g + lanes);
+            v_store(dst + g, v_pack(a >> (BITS - 8), b >> (BITS - 8)));
+        }
+#endif
+        return g;
+    }
+};
+
+template<>
+struct Unpacker<PixelPacking::Unpacked10> : UnpackedUnpacker<10>
+{
+};
+
+template<>
+struct Unpacker<PixelPacking::Unpacked12> : UnpackedUnpacker<12>
+{
+};
+
+template<>
+struct Unpacker<PixelPacking::Packed10>
+{
+    static constexpr int GROUP_PIXELS = 4;
+    static constexpr int GROUP_BYTES = 5;
+
+    static void group(const uchar* src, ushort* dst)
+    {
+        dst[0] = static_cast<ushort>(src[0] | (src[1] & 0x03) << 8);
+        dst[1] = static_cast<ushort>(src[1] >> 2 | (src[2] & 0x0F) << 6);
+        dst[2] = static_cast<ushort>(src[2] >> 4 | (src[3] & 0x3F) << 4);
+        dst[3] = static_cast<ushort>(src[3] >> 6 | src[4] << 2);
+    }
+
+    static void group(const uchar* src, uchar* dst)
+    {
+        dst[0] = static_cast<uchar>(src[0] >> 2 | (src[1] & 0x03) << 6);
+        dst[1] = static_cast<uchar>(src[1] >> 4 | (src[2] & 0x0F) << 4);
+        dst[2] = static_cast<uchar>(src[2] >> 6 | (src[3] & 0x3F) << 2);
+        dst[3] = src[4];
+    }
+
+#if CV_SIMD128
+    template<int I, typename T>
+    static v_uint16x8 samples(const v_uint64x2 (&q)[4])
+    {
+        // the 8 most significant bits start 2 bits further up
+        constexpr int shift = 10 * I + (sizeof(T) == 1 ? 2 : 0);
+        const auto mask = v_setall_u64(sizeof(T) == 1 ? 0xFF : 0x3FF);
+
+        return narrowSamples(q, [&mask](const v_uint64x2& lane) {
+            return v_shr<shift>(lane) & mask;
+        });
+    }
+#endif
+
+    template<typename T>
+    static int simd(const uchar* src, T* dst, int groups)
+    {
+        return simdFiveByteGroups<Unpacker>(src, dst, groups);
+    }
+};
+
+template<>
+struct Unpacker<PixelPacking::Packed12>
+{
+    static constexpr int GROUP_PIXELS = 2;
+    static constexpr int GROUP_BYTES = 3;
+
+    static void group(const uchar* src, ushort* dst)
+    {
+        dst[0] = static_cast<ushort>(src[0] | (src[1] & 0x0F) << 8);
+        dst[1] = static_cast<ushort>(src[1] >> 4 | src[2] << 4);
+    }
+
+    static void group(const uchar* src, uchar* dst)
+    {
+        dst[0] = static_cast<uchar>(src[0] >> 4 | (src[1] & 0x0F) << 4);
+        dst[1] = src[2];
+    }
+
+    static int simd(const uchar* src, ushort* dst, int groups)
+    {
+        int g = 0;
+#if CV_SIMD
+        constexpr int lanes = static_cast<int>(sizeof(v_uint8));
+        const v_uint16 lowNibble = vx_setall_u16(0x0F);
+
+        for (; g <= groups - lanes; g += lanes) {
+            v_uint8 a, b, c;
+            v_load_deinterleave(src + 3 * g, a, b, c);
+
+            v_uint16 a0, a1, b0, b1, c0, c1;
+            v_expand(a, a0, a1);
+            v_expand(b, b0, b1);
+            v_expand(c, c0, c1);
+
+            v_store_interleave(dst + 2 * g,
+                               a0 | (b0 & lowNibble) << 8,
+                               b0 >> 4 | c0 << 4);
+            v_store_interleave(dst + 2 * g + lanes,
+                               a1 | (b1 & lowNibble) << 8,
+                               b1 >> 4 | c1 << 4);
+        }
+#endif
+        return g;
+    }
+
+    static int simd(const uchar* src, uchar* dst, int groups)
+    {
+        int g = 0;
+#if CV_SIMD
+        constexpr int lanes = static_cast<int>(sizeof(v_uint8));
+        const v_uint16 lowNibble = vx_setall_u16(0x0F);
+
+        for (; g <= groups - lanes; g += lanes) {
+            v_uint8 a, b, c;
+            v_load_deinterleave(src + 3 * g, a, b, c);
+
+            v_uint16 a0, a1, b0, b1;
+            v_expand(a, a0, a1);
+            v_expand(b, b0, b1);
+
+            // the high byte of the second sample is the third byte as is
+            v_store_interleave(dst + 2 * g,
+                               v_pack(a0 >> 4 | (b0 & lowNibble) << 4,
+                                      a1 >> 4 | (b1 & lowNibble) << 4),
+                               c);
+        }
+#endif
+        return g;
+    }
+};
+
+template<>
+struct Unpacker<PixelPacking::Grouped10>
+{
+    static constexpr int GROUP_PIXELS = 4;
+    static constexpr int GROUP_BYTES = 5;
+
+    static void group(const uchar* src, ushort* dst)
+    {
+        for (int i = 0; i < 4; i++)
+            dst[i] =
+              static_cast<ushort>(src[i] << 2 | (src[4] >> 2 * i & 0x03));
+    }
+
+    static void group(const uchar* src, uchar* dst)
+    {
+        std::memcpy(dst, src, 4);
+    }
+
+#if CV_SIMD128
+    template<int I, typename T>
+    static v_uint16x8 samples(const v_uint64x2 (&q)[4])
+    {
+        const auto high = v_setall_u64(0xFF), low = v_setall_u64(0x03);
+
+        if constexpr (sizeof(T) == 1)
+            return narrowSamples(q, [&high](const v_uint64x2& lane) {
+                return v_shr<8 * I>(lane) & high;
+            });
+        else
+            return narrowSamples(q, [&high, &low](const v_uint64x2& lane) {
+                return v_shl<2>(v_shr<8 * I>(lane) & high) |
+                       (v_shr<32 + 2 * I>(lane) & low);
+            });
+    }
+#endif
+
+    template<typename T>
+    static int simd(const uchar* src, T* dst, int groups)
+    {
+        return simdFiveByteGroups<Unpacker>(src, dst, groups);
+    }
+};
+
+template<>
+struct Unpacker<PixelPacking::Grouped12>
+{
+    static constexpr int GROUP_PIXELS = 2;
+    static constexpr int GROUP_BYTES = 3;
+
+    static void group(const uchar* src, ushort* dst)
+    {
+        dst[0] = static_cast<ushort>(src[0] << 4 | (src[2] & 0x0F));
+        dst[1] = static_cast<ushort>(src[1] << 4 | src[2] >> 4);
+    }
+
+    static void group(const uchar* src, uchar* dst)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+    }
+
+    static int simd(const uchar* src, ushort* dst, int groups)
+    {
+        int g = 0;
+#if CV_SIMD
+        constexpr int lanes = static_cast<int>(sizeof(v_uint8));
+        const v_uint16 lowNibble = vx_setall_u16(0x0F);
+
+        for (; g <= groups - lanes; g += lanes) {
+            v_uint8 a, b, c;
+            v_load_deinterleave(src + 3 * g, a, b, c);
+
+            v_uint16 a0, a1, b0, b1, c0, c1;
+            v_expand(a, a0, a1);
+            v_expand(b, b0, b1);
+            v_expand(c, c0, c1);
+
+            v_store_interleave(
+              dst + 2 * g, a0 << 4 | (c0 & lowNibble), b0 << 4 | c0 >> 4);
+            v_store_interleave(dst + 2 * g + lanes,
+                               a1 << 4 | (c1 & lowNibble),
+                               b1 << 4 | c1 >> 4);
+        }
+#endif
+        return g;
+    }
+
+    static int simd(const uchar* src, uchar* dst, int groups)
+    {
+        int g = 0;
+#if CV_SIMD
+        constexpr int lanes = static_cast<int>(sizeof(v_uint8));
+
+        for (; g <= groups - lanes; g += lanes) {
+            v_uint8 a, b, c;
+            v_load_deinterleave(src + 3 * g, a, b, c);
+            v_store_interleave(dst + 2 * g, a, b);
+        }
+#endif
+        return g;
+    }
+};
+
+template<PixelPacking P, typename T>
+void
+unpackGroups(const uchar* src, T* dst, int groups)
+{
+    using U = Unpacker<P>;
+
+    int g = U::simd(src, dst, groups);
+    for (; g < groups; g++)
+        U::group(src + g * U::GROUP_BYTES, dst + g * U::GROUP_PIXELS);
+}
+
+template<PixelPacking P, typename T>
+void
+unpack(const uchar* src, T* dst, size_t count)
+{
+    using U = Unpacker<P>;
+
+    const int groups = static_cast<int>(count / U::GROUP_PIXELS);
+
+    // stripes of whole groups, large enough to amortize the task overhead
+    constexpr int STRIPE_GROUPS = 1 << 14;
+    parallel_for_(
+      Range(0, (groups + STRIPE_GROUPS - 1) / STRIPE_GROUPS),
+      [&](const Range& stripes) {
+          const int begin = stripes.start * STRIPE_GROUPS;
+          const int end = std::min(groups, stripes.end * STRIPE_GROUPS);
+          unpackGroups<P>(src + static_cast<size_t>(begin) * U::GROUP_BYTES,
+                          dst + static_cast<size_t>(begin) * U::GROUP_PIXELS,
+                          end - begin);
+#if CV_SIMD
+          vx_cleanup();
+#endif
+      });
+
+    // a trailing partial group, if the sample count is not a multiple
+    const size_t done = static_cast<size_t>(groups) * U::GROUP_PIXELS;
+    if (count > done) {
+        const size_t offset = static_cast<size_t>(groups) * U::GROUP_BYTES;
+        uchar in[U::GROUP_BYTES] = {};
+        T out[U::GROUP_PIXELS];
+
+        std::memcpy(in, src + offset, packedSize(P, count) - offset);
+        U::group(in, out);
+        std::memcpy(dst + done, out, (count - done) * sizeof(T));
+    }
+}
+
+template<typename T>
+void
+dispatch(const uchar* src, PixelPacking packing, T* dst, size_t count)
+{
+    switch (packing) {
+        case PixelPacking::Unpacked10:
+            return unpack<PixelPacking::Unpacked10>(src, dst, count);
+        case PixelPacking::Unpacked12:
+            return unpack<PixelPacking::Unpacked12>(src, dst, count);
+        case PixelPacking::Packed10:
+            return unpack<PixelPacking::Packed10>(src, dst, count);
+        case PixelPacking::Packed12:
+            return unpack<PixelPacking::Packed12>(src, dst, count);
+        case PixelPacking::Grouped10:
+            return unpack<PixelPacking::Grouped10>(src, dst, count);
+        case PixelPacking::Grouped12:
+            return unpack<PixelPacking::Grouped12>(src, dst, count);
+        default:
+            CV_Error(Error::StsBadArg, "Unsupported pixel packing");
+    }
+}
+
+}
+
+size_t
+packedSize(PixelPacking packing, size_t count)
+{
+    switch (packing) {
+        case PixelPacking::None8:
+            return count;
+        case PixelPacking::Unpacked10:
+        case PixelPacking::Unpacked12:
+            return 2 * count;
+        case PixelPacking::Packed10:
+        case PixelPacking::Grouped10:
+            return (10 * count + 7) / 8;
+        case PixelPacking::Packed12:
+        case PixelPacking::Grouped12:
+            return (12 * count + 7) / 8;
+    }
+
+    return 0;
+}
+
+int
+sampleBits(PixelPacking packing)
+{
+    switch (packing) {
+        case PixelPacking::None8:
+            return 8;
+        case PixelPacking::Unpacked10:
+        case PixelPacking::Packed10:
+        case PixelPacking::Grouped10:
+            return 10;
+        case PixelPacking::Unpacked12:
+        case PixelPacking::Packed12:
+        case PixelPacking::Grouped12:
+            return 12;
+    }
+
+    return 8;
+}
+
+void
+unpackPixels(const void* src, PixelPacking packing, Mat& dst)
+{
+    CV_Assert(dst.isContinuous());
+
+    const auto* bytes = static_cast<const uchar*>(src);
+
+    if (packing == PixelPacking::None8) {
+        CV_Assert(dst.type() == CV_8UC1);
+        std::memcpy(dst.data, bytes, dst.total());
+    } else if (dst.type() == CV_16UC1)
+        dispatch(bytes, packing, dst.ptr<ushort>(), dst.total());
+    else if (dst.type() == CV_8UC1)
+        dispatch(bytes, packing, dst.ptr<uchar>(), dst.total());
+    else
+        CV_Error(Error::StsUnsupportedFormat, "dst has to be 8 or 16 bit");
+}
+
+}
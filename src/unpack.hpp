@@ -0,0 +1,46 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+namespace cv {
+
+/**
+ *  Memory layouts of the pixel formats with more than 8 bits per sample.
+ */
+enum class PixelPacking
+{
+    // one sample per byte
+    None8,
+    // one sample per little-endian 16-bit word, LSB-aligned
+    Unpacked10,
+    Unpacked12,
+    // GenICam Mono10p/Mono12p: samples packed back to back, LSB first
+    Packed10,
+    Packed12,
+    // IDS Mono10g40IDS/Mono12g24IDS: the high 8 bits of each sample in
+    // separate bytes, followed by a byte holding the remaining low bits
+    Grouped10,
+    Grouped12,
+};
+
+/**
+ *  Number of bytes occupied by count samples in the given packing.
+ */
+size_t
+packedSize(PixelPacking packing, size_t count);
+
+/**
+ *  Significant bits of each sample in the given packing.
+ */
+int
+sampleBits(PixelPacking packing);
+
+/**
+ *  Unpacks dst.total() samples starting at src into dst, which has to be a
+ *  continuous CV_16UC1 (LSB-aligned samples) or CV_8UC1 (the 8 most
+ *  significant bits of each sample) matrix.
+ */
+void
+unpackPixels(const void* src, PixelPacking packing, Mat& dst);
+
+}